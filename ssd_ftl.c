@@ -0,0 +1,5823 @@
+/*
+  FTL and NAND simulation library
+  Copyright (C) 2008       SUSE Linux Products GmbH
+  Copyright (C) 2008       Tejun Heo <teheo@suse.de>
+  This program can be distributed under the terms of the GNU GPLv2.
+  See the file COPYING.
+*/
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <math.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "ssd_ftl.h"
+
+// Metadata files kept in the reserved region next to the NAND blocks
+#define CKPT_NAME          "nand_ckpt"
+#define JOURNAL_NAME       "nand_journal"
+#define CKPT_MAGIC         (0x54504B43U) // "CKPT"
+#define JOURNAL_MAGIC      (0x4C4E524AU) // "JRNL"
+#define CKPT_VERSION       (7)
+// Number of journal records after which a new checkpoint is taken
+#define JOURNAL_CKPT_LIMIT (256)
+
+// GC pacing: a victim is taken once spreading its work needs GC_PACE_STEPS steps per host page
+#define GC_PACE_STEPS (2)
+#define GC_PACE_UNIT  (1024) // Fixed point scale of the GC debt
+
+// SLC cache: folding into the main blocks starts once host writes have been idle this long by default
+#define SLC_DEFAULT_IDLE_MS (10)
+
+// Out-of-band area stored after the data pages of every NAND file
+#define OOB_MAGIC          (0x3342304FU) // "O0B3"
+// Every OOB record has a sector of its own, so it can be transferred with O_DIRECT
+#define NAND_OOB_SLOT      (512)
+#define OOB_OFFSET(page)   (PAGES_PER_BLOCK * 512 + (page) * NAND_OOB_SLOT)
+
+// Per-page out-of-band metadata, programmed together with the page data
+struct nand_oob
+{
+    uint32_t magic;
+    uint32_t lba;
+    uint64_t seq;         // Global program sequence number
+    uint32_t erase_count; // Erase count of the block when programmed
+    uint32_t crc;         // CRC32C over page data and the fields above
+    uint64_t prog_time;   // Wall clock time of the program in ns, for retention
+};
+
+// Compressed LBAs are packed several to a page, the page starts with a header listing them
+#define PACKED_LBA      (0xFFFFFFFEU) // OOB and P2L LBA of a packed page
+#define SNAP_LBA        (0xFFFFFFFDU) // OOB, P2L and packed slot LBA of data only snapshots still hold
+#define PACK_MAX_SLOTS  (8)
+#define PACK_HDR_SIZE(n) (sizeof(uint32_t) + (n) * sizeof(struct pack_slot))
+// Largest compressed LBA worth packing, any two of them share a page
+#define PACK_MAX_LEN    ((512 - PACK_HDR_SIZE(2)) / 2)
+
+// Where one LBA lives in a packed page
+struct pack_slot
+{
+    uint32_t lba;
+    uint16_t offset;
+    uint16_t length;
+};
+
+struct pack_hdr
+{
+    uint32_t count;
+    struct pack_slot slot[PACK_MAX_SLOTS];
+};
+
+// L2P_slice entry of a compressed LBA, 0 when the LBA has a page of its own
+#define SLICE(offset, length) (((uint32_t)(offset) << 16) | (length))
+#define SLICE_OFFSET(slice)   ((slice) >> 16)
+#define SLICE_LENGTH(slice)   ((slice) & 0xFFFF)
+
+// Fingerprint index of deduplication, direct mapped by hash. It is kept in memory only and an
+// entry is just a hint, the data it names is compared before an LBA is mapped to it.
+#define DEDUP_INDEX_SIZE (4096)
+
+struct dedup_entry
+{
+    uint64_t hash;
+    unsigned int pca;  // INVALID_PCA if the entry is unused
+    uint32_t slice;
+};
+
+// NAND operations that can be interrupted by a power cut
+enum
+{
+    POWERCUT_ANY,
+    POWERCUT_PROGRAM,
+    POWERCUT_ERASE,
+    POWERCUT_GC,
+};
+
+// ECC engine model
+#define ECC_DEFAULT_RBER      (1e-4) // Raw bit error rate of a fresh block
+#define ECC_WEAR_SCALE        (50.0) // Erase count at which the wear term doubles the RBER
+#define ECC_RETENTION_HOURS   (24.0) // Retention time at which the RBER grows by the fresh rate again
+#define ECC_CORRECTABLE_BITS  (8)    // Bits the decoder can correct in one page
+#define ECC_RETRY_FACTOR      (0.5)  // RBER scale of every read-retry step
+#define ECC_MAX_RETRIES       (5)
+#define ECC_DECODE_NS_PER_BIT (200)  // Decoder time per corrected bit
+
+// NAND backend
+#define NAND_DEFAULT_QD (32)
+#define NAND_BLOCK_SIZE (PAGES_PER_BLOCK * (512 + NAND_OOB_SLOT)) // Data and OOB of one block
+
+// Page operations handed to the NAND backend in batches
+enum
+{
+    NAND_OP_READ,
+    NAND_OP_PROGRAM,
+};
+
+struct nand_req
+{
+    int op;              // NAND_OP_READ or NAND_OP_PROGRAM
+    unsigned int pca;
+    char* buf;           // 512 bytes of page data
+    size_t lba;          // LBA stored in the OOB of a program
+    struct nand_oob oob; // OOB read back or about to be programmed
+    char* oob_buf;       // Aligned sector the OOB is transferred through
+    int result;          // 512 on success, -errno on failure
+    int parts;           // Transfers of this page still in flight
+};
+
+// Pool of aligned page buffers, every buffer handed to the NAND backend comes from here
+#define NAND_ALIGN    (4096) // Memory alignment O_DIRECT accepts on any device
+#define NAND_IO_CHUNK (64)   // Pages of a host request transferred per batch
+
+// io_uring submission and completion rings, fd is -1 when the synchronous backend is used
+struct nand_ring
+{
+    int fd;
+    unsigned int* sq_head;
+    unsigned int* sq_tail;
+    unsigned int* sq_mask;
+    unsigned int* sq_array;
+    struct io_uring_sqe* sqes;
+    unsigned int* cq_head;
+    unsigned int* cq_tail;
+    unsigned int* cq_mask;
+    struct io_uring_cqe* cqes;
+    unsigned int entries;
+    unsigned int queued;   // SQEs filled but not yet submitted
+    unsigned int inflight; // SQEs submitted but not yet completed
+    void* sq_ptr;          // Ring mappings, released when the device is closed
+    size_t sq_len;
+    void* cq_ptr;
+    size_t cq_len;
+    size_t sqes_len;
+};
+
+// Journal record types
+enum
+{
+    JRNL_MAP = 1,     // arg0 = lba, arg1 = pca, arg2 = program sequence, arg3 = slice of a compressed LBA
+    JRNL_ERASE,       // arg0 = block
+    JRNL_HOST_WRITE,  // arg2 = bytes written by host, arg3 = logic size
+    JRNL_RESIZE,      // arg3 = logic size
+    JRNL_UNMAP,       // arg0 = lba, arg2 = sequence
+    JRNL_SNAP_MAP,    // arg0 = entry, arg1 = pca, arg2 = snapshot, arg3 = slice, GC moved an entry of a snapshot
+    JRNL_SNAP_CREATE, // arg0 = snapshot, arg1 = volume
+    JRNL_SNAP_DELETE, // arg0 = snapshot
+    JRNL_SNAP_RESTORE,// arg0 = volume, arg1 = snapshot
+    JRNL_CLONE,       // arg0 = volume, arg1 = source volume
+};
+
+// On-disk journal record, each one protected by its own checksum
+struct journal_rec
+{
+    uint32_t type;
+    uint32_t arg0;
+    uint32_t arg1;
+    uint32_t crc;
+    uint64_t arg2;
+    uint64_t arg3;
+};
+
+// On-disk journal header, the generation must match the checkpoint
+struct journal_hdr
+{
+    uint32_t magic;
+    uint32_t reserved;
+    uint64_t gen;
+};
+
+// On-disk checkpoint header, followed by L2P, P2L, page_valid and L2P_slice tables,
+// then the L2P and L2P_slice tables of every snapshot slot
+struct ckpt_hdr
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t nand_num;
+    uint32_t pages_per_block;
+    uint32_t total_lbas;
+    uint32_t curr_pca;
+    uint64_t gen;
+    uint64_t physic_size;
+    uint64_t logic_size[SSD_VOLUME_MAX];
+    uint64_t host_write_size;
+    uint64_t nand_write_size;
+    uint64_t write_seq;
+    uint64_t erase_counts[PHYSICAL_NAND_NUM];
+    uint64_t snap_logic_size[SSD_SNAPSHOT_MAX];
+    uint32_t crc;
+    uint32_t volumes;
+    uint32_t snap_volume[SSD_SNAPSHOT_MAX]; // SNAP_FREE for an unused slot
+};
+
+// The union of PCA rules is used to represent the physical address
+typedef union pca_rule PCA_RULE;
+union pca_rule
+{
+    unsigned int pca; // Physical Cluster Address
+    struct
+    {
+        unsigned int page : 16; // Page number
+        unsigned int block: 16; // Block number
+    } fields;
+};
+
+// State of one garbage collection, advanced a page at a time
+struct gc_run
+{
+    int victim;        // -1 when no block is being collected
+    size_t page;       // Next page of the victim to look at
+    size_t relocated;  // Valid pages copied out so far
+    uint64_t start;
+    char* page_buf;
+};
+
+// State of one zone of a zoned namespace, the pages of zone i are LBAs [i, i + 1) * PAGES_PER_BLOCK
+struct zns_zone
+{
+    int block;   // Block the zone is written to, -1 until it is opened
+    int state;   // SSD_ZONE_*
+    size_t wp;   // Pages of the zone written, LBA i of the zone is always page i of its block
+};
+
+// State of one volume, the LBAs [base, base + lbas) of the device with a logical size and a write stream of its own
+struct ssd_volume
+{
+    size_t base;
+    size_t lbas;
+    size_t logic_size;
+    PCA_RULE stream;  // Last page allocated in the block the volume writes to, INVALID_PCA without one
+};
+
+// Snapshot of the mapping of a volume. Its entries hold references on the pages they name as LBAs do,
+// so the pages stay valid and GC moves them, until the snapshot is deleted.
+#define SNAP_FREE (0xFFFFFFFFU)
+
+struct ssd_snapshot
+{
+    unsigned int vol;     // Volume it was taken of, SNAP_FREE if the slot is unused
+    size_t logic_size;
+    unsigned int* L2P;    // Entry i maps LBA i of the volume
+    uint32_t* L2P_slice;
+};
+
+// State of one device instance
+struct ssd_dev
+{
+    struct ssd_config cfg;
+    pthread_mutex_t lock;          // Protects the FTL state
+    pthread_mutex_t wlock;         // Serializes writers, held while a writer steps aside for host reads
+    pthread_cond_t reads_drained;  // Signalled once no host read waits for lock
+    unsigned int reads_waiting;    // Host reads blocked on lock, they go before GC and suspendable NAND work
+    unsigned int writes_waiting;   // Host writes blocked on wlock, folding steps aside for them
+    uint64_t last_write;           // Time the last host write finished, folding waits for the host to be idle
+    pthread_t fold_thread;         // Folds the SLC cache, only with cfg.slc_blocks
+    pthread_cond_t fold_wake;      // Signalled to stop the fold thread
+    int fold_started;              // Set by the process that started the fold thread, the one to join it
+    int fold_stop;
+
+    // FTL tables
+    size_t total_lbas;
+    unsigned int* L2P;    // Logical to Physical
+    unsigned int* P2L;    // Physical to Logical, PACKED_LBA for a page holding compressed LBAs
+    int* page_valid;
+    uint32_t* L2P_slice;  // Offset and length of compressed LBAs inside their page
+    unsigned short* page_refs; // LBAs and snapshot entries mapped to every page, rebuilt from the tables at mount
+    uint32_t* ref_head;        // First LBA or snapshot entry in the list of those mapped to every page
+    uint32_t* ref_next;        // Links of those lists, a node per LBA and per snapshot entry
+    uint32_t* ref_prev;
+    struct dedup_entry* dedup_index; // Where recently written data lives, NULL without dedup
+    PCA_RULE curr_pca;    // Current PCA
+    size_t erase_counts[PHYSICAL_NAND_NUM];
+    int GC_flag;
+    int gc_victim[PHYSICAL_NAND_NUM]; // Blocks being collected (GC may nest), never handed out by the allocator
+    struct gc_run gc_paced;           // GC spread over host writes
+    size_t gc_debt;                   // GC steps owed by host writes, in 1/GC_PACE_UNIT steps
+    size_t slc_next;                  // Page of the SLC cache host writes try next, over all cache pages
+    struct gc_run fold;               // Folding of an SLC cache block into the main blocks
+    uint64_t write_seq;
+    struct zns_zone zones[SSD_ZONE_NUM]; // Zoned namespace state, rebuilt from the block tables at mount
+    struct ssd_volume vols[SSD_VOLUME_MAX]; // Volumes, their streams are rebuilt from the block tables at mount
+    struct ssd_snapshot snaps[SSD_SNAPSHOT_MAX];
+    unsigned int* snap_L2P;  // Tables of all snapshot slots, each one as large as a volume
+    uint32_t* snap_slice;
+
+    // Counters
+    size_t physic_size;
+    size_t host_write_size;
+    size_t nand_write_size;
+    size_t gc_count; // Completed garbage collections since the device was opened
+    struct ssd_stats stats; // Updated with relaxed atomics, so they can be read without the device lock
+
+    // Power loss injection state
+    int powercut_kind;
+    size_t powercut_countdown; // Counted operations left before the cut, 0 when disarmed
+    int power_lost;            // Set from the cut until the device is remounted
+    uint32_t* acked_crc;       // Checksum of the last acknowledged data of every LBA
+    unsigned char* acked;      // 1 if the LBA was acknowledged, 2 if its last write was in flight
+
+    // ECC and timing statistics
+    uint64_t ecc_rng;
+    size_t ecc_reads;
+    size_t ecc_corrected_bits;
+    size_t ecc_retries;
+    size_t ecc_uncorrectable;
+    uint64_t nand_busy_ns; // Total simulated NAND latency
+
+    // NAND backend, every block is either a file kept open while the device is open or a memory buffer
+    int nand_fds[PHYSICAL_NAND_NUM];
+    int nand_fds_open;
+    char* nand_mem[PHYSICAL_NAND_NUM];
+    struct nand_ring ring;
+
+    // Page buffer pool
+    char* pool_base;
+    unsigned char* pool_used;
+    size_t pool_pages;
+    size_t pool_hint; // Every page below it is in use
+
+    // Journal state
+    FILE* journal_fp;
+    uint64_t journal_gen;
+    size_t journal_records;
+};
+
+// Log an FTL event when the device is verbose
+#define ftl_printf(dev, ...) do { if ((dev)->cfg.verbose) printf(__VA_ARGS__); } while (0)
+
+// Bump a statistics counter
+#define stats_add(dev, field, n) __atomic_fetch_add(&(dev)->stats.field, (n), __ATOMIC_RELAXED)
+
+static int ftl_gc(struct ssd_dev* dev);
+static int ftl_read_pages(struct ssd_dev* dev, char* buf, size_t lba_range, size_t lba);
+static void ftl_gc_pace(struct ssd_dev* dev, size_t count);
+static size_t ftl_gc_reserve(struct ssd_dev* dev);
+static int sched_yield_to_reads(struct ssd_dev* dev);
+static size_t count_free_pages(struct ssd_dev* dev);
+static size_t count_slc_free_pages(struct ssd_dev* dev);
+static void journal_append(struct ssd_dev* dev, uint32_t type, uint32_t arg0, uint32_t arg1, uint64_t arg2, uint64_t arg3);
+static int zns_mount(struct ssd_dev* dev);
+
+// Adjust the logical size of a volume, the L2P table always covers the LBAs of every volume
+static int ssd_resize(struct ssd_volume* vol, size_t new_size)
+{
+    // Check if the new size exceeds the capacity of the volume
+    if (new_size > vol->lbas * 512)
+    {
+        // Out of memory error
+        return -ENOMEM;
+    }
+
+    // Set logic size to new_size
+    vol->logic_size = new_size;
+    return 0;
+}
+
+// Expand the logical size of a volume
+static int ssd_expand(struct ssd_volume* vol, size_t new_size)
+{
+    // Logical size must be greater than current size to expand
+    if (new_size > vol->logic_size)
+    {
+        return ssd_resize(vol, new_size);
+    }
+
+    return 0;
+}
+
+// CRC32C (Castagnoli, reflected polynomial 0x82F63B78) protects pages and metadata
+#define CRC32C_POLY  (0x82F63B78U)
+// Length of each of the three streams interleaved by the hardware kernel
+#define CRC32C_SHORT (128)
+
+static uint32_t crc32c_table[8][256];
+static uint32_t crc32c_short[4][256];
+
+// Portable slicing-by-8 implementation
+static uint32_t crc32c_sw(uint32_t crc, const void* data, size_t len)
+{
+    const unsigned char* next = data;
+
+    crc = ~crc;
+    while (len && ((uintptr_t)next & 7) != 0)
+    {
+        crc = crc32c_table[0][(crc ^ *next++) & 0xFF] ^ (crc >> 8);
+        len--;
+    }
+    while (len >= 8)
+    {
+        uint64_t word;
+        memcpy(&word, next, 8);
+        word ^= crc;
+        crc = crc32c_table[7][word & 0xFF] ^
+              crc32c_table[6][(word >> 8) & 0xFF] ^
+              crc32c_table[5][(word >> 16) & 0xFF] ^
+              crc32c_table[4][(word >> 24) & 0xFF] ^
+              crc32c_table[3][(word >> 32) & 0xFF] ^
+              crc32c_table[2][(word >> 40) & 0xFF] ^
+              crc32c_table[1][(word >> 48) & 0xFF] ^
+              crc32c_table[0][word >> 56];
+        next += 8;
+        len -= 8;
+    }
+    while (len--)
+    {
+        crc = crc32c_table[0][(crc ^ *next++) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+// Multiply a vector by a 32x32 matrix over GF(2)
+static uint32_t gf2_matrix_times(const uint32_t* mat, uint32_t vec)
+{
+    uint32_t sum = 0;
+    while (vec)
+    {
+        if (vec & 1)
+        {
+            sum ^= *mat;
+        }
+        vec >>= 1;
+        mat++;
+    }
+    return sum;
+}
+
+// Square a 32x32 matrix over GF(2)
+static void gf2_matrix_square(uint32_t* square, const uint32_t* mat)
+{
+    for (int n = 0; n < 32; n++)
+    {
+        square[n] = gf2_matrix_times(mat, mat[n]);
+    }
+}
+
+// Build byte-wise tables that advance a CRC over len zero bytes
+static void crc32c_zeros(uint32_t zeros[][256], size_t len)
+{
+    uint32_t even[32], odd[32];
+    uint32_t row = 1;
+    const uint32_t* op;
+
+    // Operator for one zero bit, then squared up to one zero byte
+    odd[0] = CRC32C_POLY;
+    for (int n = 1; n < 32; n++)
+    {
+        odd[n] = row;
+        row <<= 1;
+    }
+    gf2_matrix_square(even, odd);
+    gf2_matrix_square(odd, even);
+    op = odd;
+    do
+    {
+        gf2_matrix_square(even, odd);
+        op = even;
+        len >>= 1;
+        if (len == 0)
+        {
+            break;
+        }
+        gf2_matrix_square(odd, even);
+        op = odd;
+        len >>= 1;
+    } while (len);
+
+    for (uint32_t n = 0; n < 256; n++)
+    {
+        zeros[0][n] = gf2_matrix_times(op, n);
+        zeros[1][n] = gf2_matrix_times(op, n << 8);
+        zeros[2][n] = gf2_matrix_times(op, n << 16);
+        zeros[3][n] = gf2_matrix_times(op, n << 24);
+    }
+}
+
+// Advance a CRC over CRC32C_SHORT zero bytes
+static uint32_t crc32c_shift(uint32_t crc)
+{
+    return crc32c_short[0][crc & 0xFF] ^ crc32c_short[1][(crc >> 8) & 0xFF] ^
+           crc32c_short[2][(crc >> 16) & 0xFF] ^ crc32c_short[3][crc >> 24];
+}
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+
+// SSE4.2 implementation, three independent streams hide the latency of the crc32 instruction
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw(uint32_t crc, const void* data, size_t len)
+{
+    const unsigned char* next = data;
+    uint64_t crc0 = ~crc;
+
+    while (len && ((uintptr_t)next & 7) != 0)
+    {
+        crc0 = _mm_crc32_u8(crc0, *next++);
+        len--;
+    }
+    while (len >= CRC32C_SHORT * 3)
+    {
+        uint64_t crc1 = 0, crc2 = 0;
+        const unsigned char* end = next + CRC32C_SHORT;
+        do
+        {
+            uint64_t w0, w1, w2;
+            memcpy(&w0, next, 8);
+            memcpy(&w1, next + CRC32C_SHORT, 8);
+            memcpy(&w2, next + CRC32C_SHORT * 2, 8);
+            crc0 = _mm_crc32_u64(crc0, w0);
+            crc1 = _mm_crc32_u64(crc1, w1);
+            crc2 = _mm_crc32_u64(crc2, w2);
+            next += 8;
+        } while (next < end);
+        crc0 = crc32c_shift(crc0) ^ crc1;
+        crc0 = crc32c_shift(crc0) ^ crc2;
+        next += CRC32C_SHORT * 2;
+        len -= CRC32C_SHORT * 3;
+    }
+    while (len >= 8)
+    {
+        uint64_t word;
+        memcpy(&word, next, 8);
+        crc0 = _mm_crc32_u64(crc0, word);
+        next += 8;
+        len -= 8;
+    }
+    while (len--)
+    {
+        crc0 = _mm_crc32_u8(crc0, *next++);
+    }
+    return ~(uint32_t)crc0;
+}
+#endif
+
+// Implementation selected at startup
+static uint32_t (*crc32c_impl)(uint32_t crc, const void* data, size_t len) = crc32c_sw;
+
+// Build the tables and pick the fastest implementation the CPU supports
+static void crc32c_init(void)
+{
+    for (uint32_t n = 0; n < 256; n++)
+    {
+        uint32_t crc = n;
+        for (int k = 0; k < 8; k++)
+        {
+            crc = (crc & 1) ? (CRC32C_POLY ^ (crc >> 1)) : (crc >> 1);
+        }
+        crc32c_table[0][n] = crc;
+    }
+    for (uint32_t n = 0; n < 256; n++)
+    {
+        uint32_t crc = crc32c_table[0][n];
+        for (int k = 1; k < 8; k++)
+        {
+            crc = crc32c_table[0][crc & 0xFF] ^ (crc >> 8);
+            crc32c_table[k][n] = crc;
+        }
+    }
+    crc32c_zeros(crc32c_short, CRC32C_SHORT);
+
+    crc32c_impl = crc32c_sw;
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("sse4.2"))
+    {
+        crc32c_impl = crc32c_hw;
+    }
+#endif
+}
+
+// LZ compression of one LBA, in the byte oriented LZ4 style: every sequence is a token holding the
+// literal and match lengths, longer lengths continued in bytes of 255, the literals, then the
+// 2-byte offset of the match. The last sequence has literals only.
+#define LZ_MIN_MATCH (4)
+#define LZ_HASH_BITS (9)
+
+// Store the part of a length that does not fit in its token nibble
+static int lz_put_length(unsigned char* dst, size_t cap, size_t* op, size_t length)
+{
+    for (; length >= 255; length -= 255)
+    {
+        if (*op >= cap)
+        {
+            return -1;
+        }
+        dst[(*op)++] = 255;
+    }
+    if (*op >= cap)
+    {
+        return -1;
+    }
+    dst[(*op)++] = length;
+    return 0;
+}
+
+static int lz_get_length(const unsigned char* src, size_t len, size_t* ip, size_t* length)
+{
+    unsigned char byte;
+    do
+    {
+        if (*ip >= len)
+        {
+            return -1;
+        }
+        byte = src[(*ip)++];
+        *length += byte;
+    } while (byte == 255);
+    return 0;
+}
+
+// Emit one sequence, match_len 0 for the final literals
+static int lz_emit(unsigned char* dst, size_t cap, size_t* op, const unsigned char* literals, size_t literal_len,
+                   size_t offset, size_t match_len)
+{
+    size_t match_code = match_len ? match_len - LZ_MIN_MATCH : 0;
+
+    if (*op >= cap)
+    {
+        return -1;
+    }
+    dst[(*op)++] = (literal_len < 15 ? literal_len : 15) << 4 | (match_code < 15 ? match_code : 15);
+    if (literal_len >= 15 && lz_put_length(dst, cap, op, literal_len - 15) != 0)
+    {
+        return -1;
+    }
+    if (*op + literal_len > cap)
+    {
+        return -1;
+    }
+    memcpy(dst + *op, literals, literal_len);
+    *op += literal_len;
+
+    if (match_len == 0)
+    {
+        return 0;
+    }
+    if (*op + 2 > cap)
+    {
+        return -1;
+    }
+    dst[(*op)++] = offset & 0xFF;
+    dst[(*op)++] = offset >> 8;
+    if (match_code >= 15 && lz_put_length(dst, cap, op, match_code - 15) != 0)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+// Compress len bytes into at most cap bytes, return the compressed length or 0 if it does not fit
+static size_t lz_compress(const unsigned char* src, size_t len, unsigned char* dst, size_t cap)
+{
+    uint16_t table[1 << LZ_HASH_BITS];
+    size_t ip = 0, anchor = 0, op = 0;
+
+    memset(table, 0, sizeof(table));
+    while (ip + LZ_MIN_MATCH <= len)
+    {
+        uint32_t sequence;
+        memcpy(&sequence, src + ip, sizeof(sequence));
+        uint32_t hash = (sequence * 2654435761U) >> (32 - LZ_HASH_BITS);
+        size_t ref = table[hash];
+        table[hash] = ip;
+
+        if (ref >= ip || memcmp(src + ref, src + ip, LZ_MIN_MATCH) != 0)
+        {
+            ip++;
+            continue;
+        }
+
+        size_t match_len = LZ_MIN_MATCH;
+        while (ip + match_len < len && src[ref + match_len] == src[ip + match_len])
+        {
+            match_len++;
+        }
+        if (lz_emit(dst, cap, &op, src + anchor, ip - anchor, ip - ref, match_len) != 0)
+        {
+            return 0;
+        }
+        ip += match_len;
+        anchor = ip;
+    }
+    if (lz_emit(dst, cap, &op, src + anchor, len - anchor, 0, 0) != 0)
+    {
+        return 0;
+    }
+    return op;
+}
+
+// Decompress exactly cap bytes, 0 on success or -1 if the input is corrupted
+static int lz_decompress(const unsigned char* src, size_t len, unsigned char* dst, size_t cap)
+{
+    size_t ip = 0, op = 0;
+
+    while (ip < len)
+    {
+        unsigned char token = src[ip++];
+        size_t literal_len = token >> 4;
+        size_t match_len = token & 15;
+        size_t offset;
+
+        if (literal_len == 15 && lz_get_length(src, len, &ip, &literal_len) != 0)
+        {
+            return -1;
+        }
+        if (ip + literal_len > len || op + literal_len > cap)
+        {
+            return -1;
+        }
+        memcpy(dst + op, src + ip, literal_len);
+        ip += literal_len;
+        op += literal_len;
+        if (ip == len)
+        {
+            break;
+        }
+
+        if (ip + 2 > len)
+        {
+            return -1;
+        }
+        offset = src[ip] | src[ip + 1] << 8;
+        ip += 2;
+        if (match_len == 15 && lz_get_length(src, len, &ip, &match_len) != 0)
+        {
+            return -1;
+        }
+        match_len += LZ_MIN_MATCH;
+        if (offset == 0 || offset > op || op + match_len > cap)
+        {
+            return -1;
+        }
+        // Byte by byte, a match may overlap the data it produces
+        for (size_t i = 0; i < match_len; i++, op++)
+        {
+            dst[op] = dst[op - offset];
+        }
+    }
+    return op == cap ? 0 : -1;
+}
+
+// XXH64 of a buffer, the fingerprint of deduplicated data. Four independent lanes take
+// 32 bytes per round, so the compiler keeps them in registers and vectorizes the round.
+#define XXH_PRIME64_1 (0x9E3779B185EBCA87ULL)
+#define XXH_PRIME64_2 (0xC2B2AE3D27D4EB4FULL)
+#define XXH_PRIME64_3 (0x165667B19E3779F9ULL)
+#define XXH_PRIME64_4 (0x85EBCA77C2B2AE63ULL)
+#define XXH_PRIME64_5 (0x27D4EB2F165667C5ULL)
+
+static uint64_t xxh_rotl(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t xxh_read64(const unsigned char* p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint32_t xxh_read32(const unsigned char* p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint64_t xxh_round(uint64_t acc, uint64_t input)
+{
+    acc += input * XXH_PRIME64_2;
+    return xxh_rotl(acc, 31) * XXH_PRIME64_1;
+}
+
+static uint64_t xxh_merge(uint64_t acc, uint64_t lane)
+{
+    acc ^= xxh_round(0, lane);
+    return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+static uint64_t xxh64(const void* data, size_t len, uint64_t seed)
+{
+    const unsigned char* p = data;
+    const unsigned char* end = p + len;
+    uint64_t h;
+
+    if (len >= 32)
+    {
+        uint64_t lane[4] = { seed + XXH_PRIME64_1 + XXH_PRIME64_2, seed + XXH_PRIME64_2, seed, seed - XXH_PRIME64_1 };
+        for (; p + 32 <= end; p += 32)
+        {
+            for (int i = 0; i < 4; i++)
+            {
+                lane[i] = xxh_round(lane[i], xxh_read64(p + i * 8));
+            }
+        }
+        h = xxh_rotl(lane[0], 1) + xxh_rotl(lane[1], 7) + xxh_rotl(lane[2], 12) + xxh_rotl(lane[3], 18);
+        for (int i = 0; i < 4; i++)
+        {
+            h = xxh_merge(h, lane[i]);
+        }
+    }
+    else
+    {
+        h = seed + XXH_PRIME64_5;
+    }
+    h += len;
+
+    for (; p + 8 <= end; p += 8)
+    {
+        h ^= xxh_round(0, xxh_read64(p));
+        h = xxh_rotl(h, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+    }
+    if (p + 4 <= end)
+    {
+        h ^= xxh_read32(p) * XXH_PRIME64_1;
+        h = xxh_rotl(h, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+        p += 4;
+    }
+    for (; p < end; p++)
+    {
+        h ^= *p * XXH_PRIME64_5;
+        h = xxh_rotl(h, 11) * XXH_PRIME64_1;
+    }
+
+    h ^= h >> 33;
+    h *= XXH_PRIME64_2;
+    h ^= h >> 29;
+    h *= XXH_PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+// Continue a CRC32C over len bytes of data
+static uint32_t crc32c_update(uint32_t crc, const void* data, size_t len)
+{
+    return crc32c_impl(crc, data, len);
+}
+
+// Count a NAND operation against the power cut, return 1 if power is cut during it
+static int powercut_hit(struct ssd_dev* dev, int kind)
+{
+    if (dev->powercut_countdown == 0)
+    {
+        return 0;
+    }
+    if (dev->powercut_kind != POWERCUT_ANY &&
+        !(dev->powercut_kind == POWERCUT_GC && dev->GC_flag) &&
+        dev->powercut_kind != kind)
+    {
+        return 0;
+    }
+    if (--dev->powercut_countdown != 0)
+    {
+        return 0;
+    }
+
+    printf("Power cut injected during %s%s\n", kind == POWERCUT_PROGRAM ? "program" : "erase",
+           dev->GC_flag ? " in GC" : "");
+    dev->power_lost = 1;
+    return 1;
+}
+
+// Current wall clock time in ns
+static uint64_t now_ns(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Add an operation that took ns to a latency histogram
+static void stats_hist_add(struct ssd_lat_hist* h, uint64_t ns)
+{
+    unsigned int bucket = ns ? 63 - __builtin_clzll(ns) : 0;
+    uint64_t max = __atomic_load_n(&h->max_ns, __ATOMIC_RELAXED);
+
+    if (bucket >= SSD_STATS_HIST_BUCKETS)
+    {
+        bucket = SSD_STATS_HIST_BUCKETS - 1;
+    }
+    __atomic_fetch_add(&h->count[bucket], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->total, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->sum_ns, ns, __ATOMIC_RELAXED);
+    while (ns > max && !__atomic_compare_exchange_n(&h->max_ns, &max, ns, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+static void stats_lat_add(struct ssd_dev* dev, int kind, uint64_t ns)
+{
+    stats_hist_add(&dev->stats.lat[kind], ns);
+}
+
+// Account simulated NAND latency, and wait for it when the timing model is enabled.
+// A suspendable program or erase is suspended while host reads wait for the device,
+// so a read only waits for the suspend latency instead of the whole operation.
+static void nand_delay(struct ssd_dev* dev, uint64_t ns, int suspendable)
+{
+    uint64_t deadline, now;
+
+    dev->nand_busy_ns += ns;
+    if (!dev->cfg.timing)
+    {
+        return;
+    }
+
+    deadline = now_ns(CLOCK_MONOTONIC) + ns;
+    while ((now = now_ns(CLOCK_MONOTONIC)) < deadline)
+    {
+        uint64_t left = deadline - now;
+
+        if (suspendable && __atomic_load_n(&dev->reads_waiting, __ATOMIC_RELAXED))
+        {
+            uint64_t suspended = now + NAND_SUSPEND_LATENCY_US * 1000ULL;
+            while (now_ns(CLOCK_MONOTONIC) < suspended)
+                ;
+            sched_yield_to_reads(dev);
+            stats_add(dev, nand_suspends, 1);
+            dev->nand_busy_ns += NAND_SUSPEND_LATENCY_US * 1000ULL;
+
+            // Resume with the time the operation still had left
+            deadline = now_ns(CLOCK_MONOTONIC) + left;
+            continue;
+        }
+
+        // Sleep for the bulk of long waits, spin for the rest to keep microsecond precision.
+        // A suspendable operation naps in short slices to notice arriving reads.
+        if (left > 200000)
+        {
+            uint64_t nap = left - 100000;
+            if (suspendable && nap > NAND_SUSPEND_POLL_US * 1000ULL)
+            {
+                nap = NAND_SUSPEND_POLL_US * 1000ULL;
+            }
+            struct timespec ts = { nap / 1000000000, nap % 1000000000 };
+            nanosleep(&ts, NULL);
+        }
+    }
+}
+
+// xorshift64* generator driving the bit error injection
+static uint64_t ecc_rand(struct ssd_dev* dev)
+{
+    dev->ecc_rng ^= dev->ecc_rng >> 12;
+    dev->ecc_rng ^= dev->ecc_rng << 25;
+    dev->ecc_rng ^= dev->ecc_rng >> 27;
+    return dev->ecc_rng * 0x2545F4914F6CDD1DULL;
+}
+
+// Number of raw bit errors in one read, Poisson distributed with mean lambda
+static size_t ecc_sample_errors(struct ssd_dev* dev, double lambda)
+{
+    double u;
+
+    if (lambda > 30.0)
+    {
+        // Normal approximation for large means
+        double u1 = (ecc_rand(dev) >> 11) * (1.0 / 9007199254740992.0);
+        double u2 = (ecc_rand(dev) >> 11) * (1.0 / 9007199254740992.0);
+        double n = sqrt(-2.0 * log(u1 + 1e-300)) * cos(2.0 * M_PI * u2);
+        double errors = lambda + sqrt(lambda) * n;
+        return errors > 0 ? (size_t)errors : 0;
+    }
+
+    size_t k = 0;
+    double limit = exp(-lambda);
+    double p = 1.0;
+    do
+    {
+        k++;
+        u = (ecc_rand(dev) >> 11) * (1.0 / 9007199254740992.0);
+        p *= u;
+    } while (p > limit);
+    return k - 1;
+}
+
+// Decoder stand-in: compare the raw codeword against the stored one word by word
+static size_t ecc_decode(const uint64_t* raw, const uint64_t* stored, size_t words)
+{
+    size_t errors = 0;
+    for (size_t i = 0; i < words; i++)
+    {
+        errors += __builtin_popcountll(raw[i] ^ stored[i]);
+    }
+    return errors;
+}
+
+// Read a page through the simulated ECC engine, injecting raw bit errors that grow
+// with wear and retention, and retrying with shifted read levels when decoding fails.
+// The array read and decode time is added to lat_ns.
+static int ecc_read(struct ssd_dev* dev, char* buf, size_t erase_count, uint64_t prog_time, uint64_t* lat_ns)
+{
+    uint64_t raw[512 / sizeof(uint64_t)];
+    uint64_t stored[512 / sizeof(uint64_t)];
+    double hours = 0.0;
+    double rber;
+    uint64_t now = now_ns(CLOCK_REALTIME);
+
+    *lat_ns += NAND_READ_LATENCY_US * 1000ULL;
+    if (!dev->cfg.ecc)
+    {
+        return 0;
+    }
+
+    if (prog_time != 0 && now > prog_time)
+    {
+        hours = (now - prog_time) / 3.6e12;
+    }
+    rber = dev->cfg.ecc_rber * (1.0 + erase_count / ECC_WEAR_SCALE) * (1.0 + erase_count / ECC_WEAR_SCALE) +
+           dev->cfg.ecc_rber * hours / ECC_RETENTION_HOURS;
+    dev->ecc_reads++;
+    memcpy(stored, buf, 512);
+
+    for (int retry = 0; retry <= ECC_MAX_RETRIES; retry++)
+    {
+        size_t flips = ecc_sample_errors(dev, rber * 512 * 8);
+        size_t errors;
+
+        if (retry > 0)
+        {
+            // Every retry is another array read at shifted read voltages
+            dev->ecc_retries++;
+            *lat_ns += NAND_READ_LATENCY_US * 1000ULL;
+        }
+
+        memcpy(raw, stored, 512);
+        for (size_t i = 0; i < flips; i++)
+        {
+            uint64_t bit = ecc_rand(dev) % (512 * 8);
+            raw[bit / 64] ^= 1ULL << (bit % 64);
+        }
+
+        errors = ecc_decode(raw, stored, 512 / sizeof(uint64_t));
+        *lat_ns += errors * ECC_DECODE_NS_PER_BIT;
+        if (errors <= ECC_CORRECTABLE_BITS)
+        {
+            dev->ecc_corrected_bits += errors;
+            return 0;
+        }
+        rber *= ECC_RETRY_FACTOR;
+    }
+
+    dev->ecc_uncorrectable++;
+    return -EIO;
+}
+
+// Checksum of a programmed page, covering its data and OOB fields
+static uint32_t nand_oob_crc(const char* buf, const struct nand_oob* oob)
+{
+    struct nand_oob tmp = *oob;
+    tmp.crc = 0;
+    return crc32c_update(crc32c_update(0, buf, 512), &tmp, sizeof(tmp));
+}
+
+// Allocate the page buffer pool, its size bounds the memory used for NAND transfers
+static int page_pool_init(struct ssd_dev* dev, size_t pages)
+{
+    if (posix_memalign((void**)&dev->pool_base, NAND_ALIGN, pages * 512) != 0)
+    {
+        return -ENOMEM;
+    }
+    dev->pool_used = calloc(pages, 1);
+    if (dev->pool_used == NULL)
+    {
+        free(dev->pool_base);
+        dev->pool_base = NULL;
+        return -ENOMEM;
+    }
+    dev->pool_pages = pages;
+    return 0;
+}
+
+// Take count contiguous pages from the pool, NULL if no run is free
+static char* page_pool_get(struct ssd_dev* dev, size_t count)
+{
+    size_t run = 0;
+
+    for (size_t idx = dev->pool_hint; idx < dev->pool_pages; idx++)
+    {
+        run = dev->pool_used[idx] ? 0 : run + 1;
+        if (run == count)
+        {
+            size_t first = idx + 1 - count;
+            memset(dev->pool_used + first, 1, count);
+            if (first == dev->pool_hint)
+            {
+                dev->pool_hint = idx + 1;
+            }
+            return dev->pool_base + first * 512;
+        }
+    }
+    printf("Page buffer pool exhausted, %zu pages requested\n", count);
+    return NULL;
+}
+
+// Return pages taken with page_pool_get
+static void page_pool_put(struct ssd_dev* dev, char* buf, size_t count)
+{
+    if (buf != NULL)
+    {
+        size_t first = (buf - dev->pool_base) / 512;
+        memset(dev->pool_used + first, 0, count);
+        if (first < dev->pool_hint)
+        {
+            dev->pool_hint = first;
+        }
+    }
+}
+
+// Open the NAND file of every block once, creating missing ones and keeping existing data
+static int nand_open(struct ssd_dev* dev)
+{
+    char nand_name[PATH_MAX];
+    int flags = O_RDWR | O_CREAT;
+
+    if (dev->nand_fds_open)
+    {
+        return 0;
+    }
+
+    // Without a NAND directory every block lives in memory, an erased block reads as zeros
+    if (dev->cfg.nand_dir == NULL)
+    {
+        for (int idx = 0; idx < PHYSICAL_NAND_NUM; idx++)
+        {
+            if (posix_memalign((void**)&dev->nand_mem[idx], NAND_ALIGN, NAND_BLOCK_SIZE) != 0)
+            {
+                while (idx-- > 0)
+                {
+                    free(dev->nand_mem[idx]);
+                    dev->nand_mem[idx] = NULL;
+                }
+                return -ENOMEM;
+            }
+            memset(dev->nand_mem[idx], 0, NAND_BLOCK_SIZE);
+        }
+        dev->nand_fds_open = 1;
+        return 0;
+    }
+
+    // Not every file system supports O_DIRECT, fall back to buffered I/O there
+    if (dev->cfg.direct)
+    {
+        snprintf(nand_name, sizeof(nand_name), "%s/nand_0", dev->cfg.nand_dir);
+        int fd = open(nand_name, flags | O_DIRECT, 0644);
+        if (fd < 0 && errno == EINVAL)
+        {
+            printf("O_DIRECT is not supported for %s, using buffered NAND I/O\n", dev->cfg.nand_dir);
+            dev->cfg.direct = 0;
+        }
+        else
+        {
+            flags |= O_DIRECT;
+        }
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+    }
+
+    for (int idx = 0; idx < PHYSICAL_NAND_NUM; idx++)
+    {
+        snprintf(nand_name, sizeof(nand_name), "%s/nand_%d", dev->cfg.nand_dir, idx);
+        dev->nand_fds[idx] = open(nand_name, flags, 0644);
+        if (dev->nand_fds[idx] < 0)
+        {
+            printf("Failed to open NAND file %s\n", nand_name);
+            while (idx-- > 0)
+            {
+                close(dev->nand_fds[idx]);
+            }
+            return -EIO;
+        }
+    }
+    dev->nand_fds_open = 1;
+    return 0;
+}
+
+// Close the NAND files, or drop the in-memory NAND
+static void nand_close(struct ssd_dev* dev)
+{
+    if (!dev->nand_fds_open)
+    {
+        return;
+    }
+    for (int idx = 0; idx < PHYSICAL_NAND_NUM; idx++)
+    {
+        if (dev->nand_mem[idx] != NULL)
+        {
+            free(dev->nand_mem[idx]);
+            dev->nand_mem[idx] = NULL;
+        }
+        else
+        {
+            close(dev->nand_fds[idx]);
+        }
+    }
+    dev->nand_fds_open = 0;
+}
+
+// Read part of a block from its NAND file or memory
+static ssize_t nand_pread(struct ssd_dev* dev, size_t block, void* buf, size_t len, off_t offset)
+{
+    if (dev->nand_mem[block] != NULL)
+    {
+        memcpy(buf, dev->nand_mem[block] + offset, len);
+        return len;
+    }
+    return pread(dev->nand_fds[block], buf, len, offset);
+}
+
+// Write part of a block to its NAND file or memory
+static ssize_t nand_pwrite(struct ssd_dev* dev, size_t block, const void* buf, size_t len, off_t offset)
+{
+    if (dev->nand_mem[block] != NULL)
+    {
+        memcpy(dev->nand_mem[block] + offset, buf, len);
+        return len;
+    }
+    return pwrite(dev->nand_fds[block], buf, len, offset);
+}
+
+// Return a whole block to the erased state
+static int nand_truncate(struct ssd_dev* dev, size_t block)
+{
+    if (dev->nand_mem[block] != NULL)
+    {
+        memset(dev->nand_mem[block], 0, NAND_BLOCK_SIZE);
+        return 0;
+    }
+    return ftruncate(dev->nand_fds[block], 0);
+}
+
+// Set up an io_uring with room for depth page operations, each one uses two SQEs
+static int nand_ring_init(struct ssd_dev* dev, unsigned int depth)
+{
+    struct nand_ring* ring = &dev->ring;
+    struct io_uring_params params;
+    size_t sq_len, cq_len;
+    char* sq_ptr;
+    char* cq_ptr;
+
+    memset(&params, 0, sizeof(params));
+    ring->fd = syscall(__NR_io_uring_setup, depth * 2, &params);
+    if (ring->fd < 0)
+    {
+        return -errno;
+    }
+
+    sq_len = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    cq_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        sq_len = cq_len = sq_len > cq_len ? sq_len : cq_len;
+    }
+
+    sq_ptr = mmap(NULL, sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (sq_ptr == MAP_FAILED)
+    {
+        close(ring->fd);
+        ring->fd = -1;
+        return -ENOMEM;
+    }
+    cq_ptr = sq_ptr;
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP))
+    {
+        cq_ptr = mmap(NULL, cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if (cq_ptr == MAP_FAILED)
+        {
+            munmap(sq_ptr, sq_len);
+            close(ring->fd);
+            ring->fd = -1;
+            return -ENOMEM;
+        }
+    }
+    ring->sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED)
+    {
+        if (cq_ptr != sq_ptr)
+        {
+            munmap(cq_ptr, cq_len);
+        }
+        munmap(sq_ptr, sq_len);
+        close(ring->fd);
+        ring->fd = -1;
+        return -ENOMEM;
+    }
+
+    ring->sq_head = (unsigned int*)(sq_ptr + params.sq_off.head);
+    ring->sq_tail = (unsigned int*)(sq_ptr + params.sq_off.tail);
+    ring->sq_mask = (unsigned int*)(sq_ptr + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned int*)(sq_ptr + params.sq_off.array);
+    ring->cq_head = (unsigned int*)(cq_ptr + params.cq_off.head);
+    ring->cq_tail = (unsigned int*)(cq_ptr + params.cq_off.tail);
+    ring->cq_mask = (unsigned int*)(cq_ptr + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq_ptr + params.cq_off.cqes);
+    ring->entries = params.sq_entries;
+    ring->queued = 0;
+    ring->inflight = 0;
+    ring->sq_ptr = sq_ptr;
+    ring->sq_len = sq_len;
+    ring->cq_ptr = cq_ptr;
+    ring->cq_len = cq_len;
+    ring->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+    return 0;
+}
+
+// Tear down the io_uring of a device
+static void nand_ring_exit(struct ssd_dev* dev)
+{
+    struct nand_ring* ring = &dev->ring;
+
+    if (ring->fd < 0)
+    {
+        return;
+    }
+    munmap(ring->sqes, ring->sqes_len);
+    if (ring->cq_ptr != ring->sq_ptr)
+    {
+        munmap(ring->cq_ptr, ring->cq_len);
+    }
+    munmap(ring->sq_ptr, ring->sq_len);
+    close(ring->fd);
+    ring->fd = -1;
+}
+
+// Queue one SQE reading or writing part of a page, tagged with its request
+static void nand_ring_queue(struct ssd_dev* dev, int opcode, int fd, void* addr, unsigned int len, off_t offset,
+                            struct nand_req* req, int part, int link)
+{
+    struct nand_ring* ring = &dev->ring;
+    unsigned int tail = *ring->sq_tail;
+    unsigned int index = tail & *ring->sq_mask;
+    struct io_uring_sqe* sqe = &ring->sqes[index];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->addr = (uintptr_t)addr;
+    sqe->len = len;
+    sqe->off = offset;
+    sqe->flags = link ? IOSQE_IO_LINK : 0;
+    sqe->user_data = (uintptr_t)req | part;
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->queued++;
+}
+
+// Time a NAND operation keeps its block busy in the timing model
+static void nand_account(const struct nand_req* req, uint64_t ns, uint64_t* busy)
+{
+    PCA_RULE my_pca;
+    my_pca.pca = req->pca;
+    busy[my_pca.fields.block] += ns;
+}
+
+// Volume an LBA belongs to
+static unsigned int ftl_lba_volume(struct ssd_dev* dev, size_t lba)
+{
+    size_t vol = lba / dev->vols[0].lbas;
+    return vol < dev->cfg.volumes ? vol : dev->cfg.volumes - 1;
+}
+
+// Volume the data of a program belongs to. The LBAs of a packed page come from one host write, so from one volume.
+static unsigned int ftl_req_volume(struct ssd_dev* dev, const struct nand_req* req)
+{
+    return ftl_lba_volume(dev, req->lba == PACKED_LBA ? ((const struct pack_hdr*)req->buf)->slot[0].lba : req->lba);
+}
+
+// Finish a page operation once all of its transfers completed
+static void nand_complete(struct ssd_dev* dev, struct nand_req* req, uint64_t* busy)
+{
+    PCA_RULE my_pca;
+    my_pca.pca = req->pca;
+
+    if (req->op == NAND_OP_READ)
+    {
+        memcpy(&req->oob, req->oob_buf, sizeof(req->oob));
+    }
+    page_pool_put(dev, req->oob_buf, 1);
+    req->oob_buf = NULL;
+
+    if (req->result < 0)
+    {
+        return;
+    }
+
+    if (req->op == NAND_OP_PROGRAM)
+    {
+        nand_account(req, (my_pca.fields.block < dev->cfg.slc_blocks ? NAND_SLC_PROG_LATENCY_US : NAND_PROG_LATENCY_US) * 1000ULL,
+                     busy);
+
+        // Update the total amount actually written to NAND
+        dev->nand_write_size += 512;
+        stats_add(dev, nand_write_ops, 1);
+        stats_add(dev, nand_write_bytes, 512);
+        stats_add(dev, vol[ftl_req_volume(dev, req)].nand_write_ops, 1);
+        if (dev->GC_flag)
+        {
+            stats_add(dev, vol[ftl_req_volume(dev, req)].gc_pages_relocated, 1);
+        }
+        req->result = 512;
+        return;
+    }
+
+    if (req->oob.magic != OOB_MAGIC)
+    {
+        printf("Missing OOB at nand read pca = %d\n", req->pca);
+        req->result = -EIO;
+        return;
+    }
+
+    // Pass the raw page through the ECC engine
+    uint64_t lat = 0;
+    if (ecc_read(dev, req->buf, dev->erase_counts[my_pca.fields.block], req->oob.prog_time, &lat) != 0)
+    {
+        printf("Uncorrectable ECC error at nand read pca = %d\n", req->pca);
+        req->result = -EIO;
+    }
+    else if (req->oob.crc != nand_oob_crc(req->buf, &req->oob))
+    {
+        printf("CRC32C mismatch at nand read pca = %d\n", req->pca);
+        req->result = -EIO;
+    }
+    else
+    {
+        req->result = 512;
+        stats_add(dev, nand_read_ops, 1);
+        stats_add(dev, nand_read_bytes, 512);
+    }
+    nand_account(req, lat, busy);
+}
+
+// Start a page operation, return 0 if it already finished without any I/O
+static int nand_begin(struct ssd_dev* dev, struct nand_req* req)
+{
+    PCA_RULE my_pca;
+    my_pca.pca = req->pca;
+
+    req->result = 0;
+
+    // Nothing can be read or programmed without power
+    if (dev->power_lost)
+    {
+        req->result = -EIO;
+        return 0;
+    }
+
+    req->oob_buf = page_pool_get(dev, 1);
+    if (req->oob_buf == NULL)
+    {
+        req->result = -ENOMEM;
+        return 0;
+    }
+    memset(req->oob_buf, 0, NAND_OOB_SLOT);
+
+    if (req->op == NAND_OP_READ)
+    {
+        return 1;
+    }
+
+    // Fill in the OOB metadata for this page
+    memset(&req->oob, 0, sizeof(req->oob));
+    req->oob.magic = OOB_MAGIC;
+    req->oob.lba = req->lba;
+    req->oob.seq = ++dev->write_seq;
+    req->oob.erase_count = dev->erase_counts[my_pca.fields.block];
+    req->oob.prog_time = now_ns(CLOCK_REALTIME);
+    req->oob.crc = nand_oob_crc(req->buf, &req->oob);
+
+    // A program cut by power loss leaves half of the data and an OOB that fails its checksum
+    if (powercut_hit(dev, POWERCUT_PROGRAM))
+    {
+        struct nand_oob torn = req->oob;
+        torn.crc = ~torn.crc;
+        memcpy(req->oob_buf, req->buf, 256);
+        nand_pwrite(dev, my_pca.fields.block, req->oob_buf, 512, my_pca.fields.page * 512);
+        memset(req->oob_buf, 0, NAND_OOB_SLOT);
+        memcpy(req->oob_buf, &torn, sizeof(torn));
+        nand_pwrite(dev, my_pca.fields.block, req->oob_buf, NAND_OOB_SLOT, OOB_OFFSET(my_pca.fields.page));
+        page_pool_put(dev, req->oob_buf, 1);
+        req->oob_buf = NULL;
+        req->result = -EIO;
+        return 0;
+    }
+    memcpy(req->oob_buf, &req->oob, sizeof(req->oob));
+    return 1;
+}
+
+// Record the result of one data or OOB transfer. The rest of a short transfer is done with blocking calls, a read
+// only comes up short at the end of the NAND file and a program that makes no progress fails with -EIO.
+static void nand_transfer_done(struct ssd_dev* dev, struct nand_req* req, int part, ssize_t res)
+{
+    PCA_RULE my_pca;
+    my_pca.pca = req->pca;
+    size_t block = my_pca.fields.block;
+    char* buf = part == 0 ? req->buf : req->oob_buf;
+    size_t len = part == 0 ? 512 : NAND_OOB_SLOT;
+    off_t offset = part == 0 ? my_pca.fields.page * 512 : OOB_OFFSET(my_pca.fields.page);
+    ssize_t done = 0;
+
+    // A short data program cancels the OOB program linked to it, which is due once the data is complete
+    if (res == -ECANCELED && part == 1 && req->op != NAND_OP_READ && req->result == 0)
+    {
+        res = nand_pwrite(dev, block, buf, len, offset);
+        res = res < 0 ? -errno : res;
+    }
+    while (res > 0 && (size_t)(done += res) < len)
+    {
+        res = req->op == NAND_OP_READ ? nand_pread(dev, block, buf + done, len - done, offset + done)
+                                      : nand_pwrite(dev, block, buf + done, len - done, offset + done);
+        res = res < 0 ? -errno : res;
+    }
+    if (res == 0 && req->op != NAND_OP_READ)
+    {
+        res = -EIO;
+    }
+    if (res < 0)
+    {
+        if (req->result == 0)
+        {
+            printf("NAND %s transfer failed at pca = %d (%zd)\n",
+                   req->op == NAND_OP_READ ? "read" : "program", req->pca, res);
+            req->result = res == -ECANCELED ? -EIO : res;
+        }
+        return;
+    }
+    if (req->op == NAND_OP_READ)
+    {
+        // The missing tail of a short NAND file reads as erased
+        if (part == 0 && done < 512)
+        {
+            memset(req->buf + done, 0, 512 - done);
+        }
+        if (part == 1 && done < (ssize_t)sizeof(req->oob))
+        {
+            memset(req->oob_buf, 0, NAND_OOB_SLOT);
+        }
+    }
+}
+
+// Run a batch with blocking transfers, one page at a time
+static void nand_submit_sync(struct ssd_dev* dev, struct nand_req* reqs, size_t count, uint64_t* busy)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        struct nand_req* req = &reqs[i];
+        PCA_RULE my_pca;
+        my_pca.pca = req->pca;
+        size_t block = my_pca.fields.block;
+
+        if (!nand_begin(dev, req))
+        {
+            continue;
+        }
+        if (req->op == NAND_OP_READ)
+        {
+            nand_transfer_done(dev, req, 0, nand_pread(dev, block, req->buf, 512, my_pca.fields.page * 512));
+            nand_transfer_done(dev, req, 1, nand_pread(dev, block, req->oob_buf, NAND_OOB_SLOT, OOB_OFFSET(my_pca.fields.page)));
+        }
+        else
+        {
+            // Write the OOB metadata after the data, so a torn page has no OOB
+            nand_transfer_done(dev, req, 0, nand_pwrite(dev, block, req->buf, 512, my_pca.fields.page * 512));
+            if (req->result == 0)
+            {
+                nand_transfer_done(dev, req, 1, nand_pwrite(dev, block, req->oob_buf, NAND_OOB_SLOT, OOB_OFFSET(my_pca.fields.page)));
+            }
+        }
+        nand_complete(dev, req, busy);
+    }
+}
+
+// Complete the pages whose transfers have all arrived on the completion queue, return how many
+static size_t nand_ring_reap(struct ssd_dev* dev, uint64_t* busy)
+{
+    struct nand_ring* ring = &dev->ring;
+    unsigned int head = *ring->cq_head;
+    unsigned int tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    size_t done = 0;
+
+    while (head != tail)
+    {
+        struct io_uring_cqe* cqe = &ring->cqes[head & *ring->cq_mask];
+        struct nand_req* req = (struct nand_req*)(uintptr_t)(cqe->user_data & ~1ULL);
+        int part = cqe->user_data & 1;
+
+        nand_transfer_done(dev, req, part, cqe->res);
+        if (--req->parts == 0)
+        {
+            nand_complete(dev, req, busy);
+            done++;
+        }
+        ring->inflight--;
+        head++;
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    return done;
+}
+
+// Give up on a broken io_uring: take back the SQEs it never consumed, wait until the kernel is done with
+// every buffer it was handed and tear the ring down, so later batches use the synchronous backend.
+// The first next requests of the batch were started, those that did not complete fail with -EIO.
+static void nand_ring_abort(struct ssd_dev* dev, struct nand_req* reqs, size_t next, uint64_t* busy)
+{
+    struct nand_ring* ring = &dev->ring;
+
+    __atomic_store_n(ring->sq_tail, *ring->sq_tail - ring->queued, __ATOMIC_RELEASE);
+    ring->queued = 0;
+
+    // The transfers in flight still point at the buffers of the caller
+    while (ring->inflight > 0)
+    {
+        if (syscall(__NR_io_uring_enter, ring->fd, 0, ring->inflight, IORING_ENTER_GETEVENTS, NULL, 0) < 0 &&
+            errno != EINTR)
+        {
+            struct timespec ts = { 0, 1000000 };
+            nanosleep(&ts, NULL);
+        }
+        nand_ring_reap(dev, busy);
+    }
+
+    for (size_t i = 0; i < next; i++)
+    {
+        if (reqs[i].parts > 0)
+        {
+            reqs[i].result = -EIO;
+            reqs[i].parts = 0;
+            nand_complete(dev, &reqs[i], busy);
+        }
+    }
+    nand_ring_exit(dev);
+}
+
+// Run a batch through the io_uring, keeping up to the queue depth of pages in flight
+// and completing every page as soon as the CQEs of both of its transfers arrive
+static void nand_submit_uring(struct ssd_dev* dev, struct nand_req* reqs, size_t count, uint64_t* busy)
+{
+    struct nand_ring* ring = &dev->ring;
+    size_t next = 0, done = 0;
+
+    while (done < count)
+    {
+        // Fill the submission queue
+        while (next < count && ring->queued + ring->inflight + 2 <= ring->entries)
+        {
+            struct nand_req* req = &reqs[next++];
+            PCA_RULE my_pca;
+            my_pca.pca = req->pca;
+            int fd = dev->nand_fds[my_pca.fields.block];
+
+            req->parts = 0;
+            if (!nand_begin(dev, req))
+            {
+                done++;
+                continue;
+            }
+            req->parts = 2;
+            if (req->op == NAND_OP_READ)
+            {
+                nand_ring_queue(dev, IORING_OP_READ, fd, req->buf, 512, my_pca.fields.page * 512, req, 0, 0);
+                nand_ring_queue(dev, IORING_OP_READ, fd, req->oob_buf, NAND_OOB_SLOT, OOB_OFFSET(my_pca.fields.page), req, 1, 0);
+            }
+            else
+            {
+                // Linked, so the OOB is only written once the data landed
+                nand_ring_queue(dev, IORING_OP_WRITE, fd, req->buf, 512, my_pca.fields.page * 512, req, 0, 1);
+                nand_ring_queue(dev, IORING_OP_WRITE, fd, req->oob_buf, NAND_OOB_SLOT, OOB_OFFSET(my_pca.fields.page), req, 1, 0);
+            }
+        }
+        if (done == count)
+        {
+            break;
+        }
+
+        // Submit what was queued and wait for at least one completion
+        int ret = syscall(__NR_io_uring_enter, ring->fd, ring->queued, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+        if (ret < 0)
+        {
+            if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+            {
+                continue;
+            }
+            printf("io_uring_enter failed (%d), falling back to synchronous NAND access\n", -errno);
+            nand_ring_abort(dev, reqs, next, busy);
+
+            // Requests that were never started still run
+            nand_submit_sync(dev, reqs + next, count - next, busy);
+            return;
+        }
+        ring->queued -= ret;
+        ring->inflight += ret;
+
+        done += nand_ring_reap(dev, busy);
+    }
+}
+
+// Execute a batch of page reads and programs, return 0 or the first error.
+// Blocks work in parallel in the timing model, so the batch takes as long as its busiest block.
+static int nand_submit(struct ssd_dev* dev, struct nand_req* reqs, size_t count)
+{
+    uint64_t busy[PHYSICAL_NAND_NUM] = { 0 };
+    uint64_t longest = 0;
+    int ret = 0;
+
+    if (dev->ring.fd >= 0)
+    {
+        nand_submit_uring(dev, reqs, count, busy);
+    }
+    else
+    {
+        nand_submit_sync(dev, reqs, count, busy);
+    }
+
+    for (size_t block = 0; block < PHYSICAL_NAND_NUM; block++)
+    {
+        if (busy[block] > longest)
+        {
+            longest = busy[block];
+        }
+    }
+    // Programs can be suspended for host reads, reads always run to completion
+    int suspendable = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        suspendable |= reqs[i].op == NAND_OP_PROGRAM;
+    }
+    nand_delay(dev, longest, suspendable);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        if (reqs[i].result < 0 && ret == 0)
+        {
+            ret = reqs[i].result;
+        }
+    }
+    return ret;
+}
+
+// Read data from NAND, verifying it against the CRC32C stored in its OOB
+static int nand_read(struct ssd_dev* dev, char* buf, int pca)
+{
+    struct nand_req req;
+
+    memset(&req, 0, sizeof(req));
+    req.op = NAND_OP_READ;
+    req.pca = pca;
+    req.buf = buf;
+    nand_submit(dev, &req, 1);
+
+    // Return the number of bytes read
+    return req.result;
+}
+
+// Read the OOB area of a page, an erased page returns a zeroed OOB
+static int nand_read_oob(struct ssd_dev* dev, struct nand_oob* oob, int pca)
+{
+    PCA_RULE my_pca;
+    my_pca.pca = pca;
+
+    char* oob_buf = page_pool_get(dev, 1);
+
+    memset(oob, 0, sizeof(*oob));
+    if (oob_buf == NULL)
+    {
+        return -ENOMEM;
+    }
+    if (nand_pread(dev, my_pca.fields.block, oob_buf, NAND_OOB_SLOT, OOB_OFFSET(my_pca.fields.page)) == NAND_OOB_SLOT)
+    {
+        memcpy(oob, oob_buf, sizeof(*oob));
+    }
+    page_pool_put(dev, oob_buf, 1);
+    return 0;
+}
+
+// Reset the mapping state of an erased block, return the number of pages released
+static size_t erase_block_metadata(struct ssd_dev* dev, int block)
+{
+    // Calculate the number of valid pages erased
+    size_t pages_erased  = 0;
+    for (size_t i = 0; i < PAGES_PER_BLOCK; i++)
+    {
+        size_t index = block * PAGES_PER_BLOCK + i;
+        dev->page_refs[index] = 0;
+        if (dev->page_valid[index] != 0)
+        {
+            pages_erased ++;
+            dev->page_valid[index] = 0; // Mark as invalid
+            dev->P2L[index] = INVALID_LBA;
+        }
+    }
+
+    // Decrease physic_size
+    if (dev->physic_size >= pages_erased)
+        dev->physic_size -= pages_erased;
+    else
+        dev->physic_size = 0;
+
+    dev->erase_counts[block]++;
+
+    return pages_erased;
+}
+
+// Erase the specified NAND block
+static int nand_erase(struct ssd_dev* dev, int block)
+{
+    if (dev->power_lost)
+    {
+        return -EIO;
+    }
+
+    // An erase cut by power loss only wipes the first half of the pages
+    if (powercut_hit(dev, POWERCUT_ERASE))
+    {
+        char* zero = page_pool_get(dev, 1);
+        if (zero == NULL)
+        {
+            return -EIO;
+        }
+        memset(zero, 0, 512);
+        for (size_t page = 0; page < PAGES_PER_BLOCK / 2; page++)
+        {
+            nand_pwrite(dev, block, zero, 512, page * 512);
+            nand_pwrite(dev, block, zero, NAND_OOB_SLOT, OOB_OFFSET(page));
+        }
+        page_pool_put(dev, zero, 1);
+        return -EIO;
+    }
+
+    // Truncate the NAND file to erase nand
+    uint64_t start = now_ns(CLOCK_MONOTONIC);
+    if (nand_truncate(dev, block) == 0)
+    {
+        nand_delay(dev, NAND_ERASE_LATENCY_US * 1000ULL, 1);
+        stats_add(dev, erase_total, 1);
+        stats_lat_add(dev, SSD_LAT_ERASE, now_ns(CLOCK_MONOTONIC) - start);
+
+        size_t pages_erased = erase_block_metadata(dev, block);
+        journal_append(dev, JRNL_ERASE, block, 0, 0, 0);
+
+        ftl_printf(dev, "nand erase %d pass, erased %zu valid pages\n", block, pages_erased);
+
+        return 1;
+    }
+    else
+    {
+        printf("truncate fail at nand erase nand = %d, return %d\n", block, -EIO);
+        return -EIO;
+    }
+}
+
+// Get the next available PCA (physical cluster address)
+static unsigned int get_next_pca(struct ssd_dev* dev)
+{
+    // Sequential allocation strategy B
+    size_t total_pages = PHYSICAL_NAND_NUM * PAGES_PER_BLOCK ;
+
+	// Initialize curr_pca if it's invalid
+    if (dev->curr_pca.pca == INVALID_PCA)
+    {
+        dev->curr_pca.fields.block = 0;
+        dev->curr_pca.fields.page = 0;
+
+        // Wrap around to the first block if necessary
+        if (dev->curr_pca.fields.block >= PHYSICAL_NAND_NUM)
+        {
+            dev->curr_pca.fields.block = 0;
+        }
+    }
+    else
+    {
+        // Move to next page
+        dev->curr_pca.fields.page += 1;
+
+        // If the current block's pages are exhausted, move to the next block
+        if (dev->curr_pca.fields.page >= PAGES_PER_BLOCK)
+        {
+            dev->curr_pca.fields.page = 0;
+            dev->curr_pca.fields.block += 1;
+
+            // Wrap around to the first block if necessary
+            if (dev->curr_pca.fields.block >= PHYSICAL_NAND_NUM)
+            {
+                dev->curr_pca.fields.block = 0;
+            }
+        }
+    }
+
+    // Sequential allocation strategy B
+
+    // Keep track of the number of pages checked
+    size_t pages_checked = 0;
+
+    while (pages_checked < total_pages)
+    {
+        size_t index = dev->curr_pca.fields.block * PAGES_PER_BLOCK + dev->curr_pca.fields.page;
+
+        // Check if the page is invalid (-1 means invalid), relocations must not land in the GC victim.
+        // The blocks of the SLC cache have an allocator of their own.
+        if (dev->page_valid[index] == 0 && !dev->gc_victim[dev->curr_pca.fields.block] &&
+            dev->curr_pca.fields.block >= dev->cfg.slc_blocks)
+        {
+            // Found a unused page
+            dev->curr_pca.pca = (dev->curr_pca.fields.block << 16) | dev->curr_pca.fields.page;
+            ftl_printf(dev, "Allocated PCA: block %u, page %u\n", dev->curr_pca.fields.block, dev->curr_pca.fields.page);
+            return dev->curr_pca.pca;
+        }
+
+        // Move to next page
+        dev->curr_pca.fields.page += 1;
+
+        // If the current block's pages are exhausted, move to the next block
+        if (dev->curr_pca.fields.page >= PAGES_PER_BLOCK)
+        {
+            dev->curr_pca.fields.page = 0;
+            dev->curr_pca.fields.block += 1;
+        }
+
+        // Wrap around to the first block if necessary
+        if (dev->curr_pca.fields.block >= PHYSICAL_NAND_NUM)
+        {
+            dev->curr_pca.fields.block = 0;
+        }
+
+        pages_checked++;
+    }
+
+    // No free pages available, SSD is full
+    ftl_printf(dev, "No new PCA available, SSD is full\n");
+    return FULL_PCA;
+}
+
+// Erase the blocks of the SLC cache without valid data left, the cache takes host writes again without folding
+static void slc_reclaim(struct ssd_dev* dev)
+{
+    for (size_t block = 0; block < dev->cfg.slc_blocks; block++)
+    {
+        size_t used = 0, valid = 0;
+
+        for (size_t page = 0; page < PAGES_PER_BLOCK; page++)
+        {
+            used += dev->page_valid[block * PAGES_PER_BLOCK + page] != 0;
+            valid += dev->page_valid[block * PAGES_PER_BLOCK + page] == 1;
+        }
+        if (!dev->gc_victim[block] && used != 0 && valid == 0)
+        {
+            nand_erase(dev, block);
+        }
+    }
+}
+
+// Get the next free page of the SLC cache, FULL_PCA once the cache is full.
+// Only the first SLC_PAGES_PER_BLOCK pages of a cache block are usable.
+static unsigned int slc_next_pca(struct ssd_dev* dev)
+{
+    size_t cache_pages = dev->cfg.slc_blocks * SLC_PAGES_PER_BLOCK;
+
+    for (size_t i = 0; i < cache_pages; i++)
+    {
+        size_t next = (dev->slc_next + i) % cache_pages;
+        size_t block = next / SLC_PAGES_PER_BLOCK;
+        size_t page = next % SLC_PAGES_PER_BLOCK;
+
+        if (dev->page_valid[block * PAGES_PER_BLOCK + page] == 0 && !dev->gc_victim[block])
+        {
+            dev->slc_next = next + 1;
+            ftl_printf(dev, "Allocated SLC PCA: block %zu, page %zu\n", block, page);
+            return (block << 16) | page;
+        }
+    }
+    return FULL_PCA;
+}
+
+// Every page heads a list of the LBAs and snapshot entries mapped to it, so finding them takes as many steps
+// as the page has references. Node lba is an LBA, node total_lbas + s * lbas + i is entry i of snapshot s.
+#define REF_NONE (0xFFFFFFFFU)
+
+// Reference node of entry i of a snapshot
+static uint32_t snap_node(const struct ssd_dev* dev, const struct ssd_snapshot* snap, size_t i)
+{
+    return dev->total_lbas + (snap - dev->snaps) * dev->vols[0].lbas + i;
+}
+
+// Add a node to the list of the page it was mapped to
+static void ref_link(struct ssd_dev* dev, uint32_t node, unsigned int pca)
+{
+    size_t index = ((pca >> 16) & 0xFFFF) * PAGES_PER_BLOCK + (pca & 0xFFFF);
+
+    if (pca == INVALID_PCA || index >= PHYSICAL_NAND_NUM * PAGES_PER_BLOCK)
+    {
+        return;
+    }
+    dev->ref_prev[node] = REF_NONE;
+    dev->ref_next[node] = dev->ref_head[index];
+    if (dev->ref_head[index] != REF_NONE)
+    {
+        dev->ref_prev[dev->ref_head[index]] = node;
+    }
+    dev->ref_head[index] = node;
+}
+
+// Remove a node from the list of the page it is mapped to
+static void ref_unlink(struct ssd_dev* dev, uint32_t node, unsigned int pca)
+{
+    size_t index = ((pca >> 16) & 0xFFFF) * PAGES_PER_BLOCK + (pca & 0xFFFF);
+
+    if (pca == INVALID_PCA || index >= PHYSICAL_NAND_NUM * PAGES_PER_BLOCK)
+    {
+        return;
+    }
+    if (dev->ref_prev[node] != REF_NONE)
+    {
+        dev->ref_next[dev->ref_prev[node]] = dev->ref_next[node];
+    }
+    else
+    {
+        dev->ref_head[index] = dev->ref_next[node];
+    }
+    if (dev->ref_next[node] != REF_NONE)
+    {
+        dev->ref_prev[dev->ref_next[node]] = dev->ref_prev[node];
+    }
+}
+
+// Find an LBA mapped to a page, other than skip, total_lbas if there is none
+static size_t ftl_find_ref(struct ssd_dev* dev, unsigned int pca, size_t skip)
+{
+    size_t index = ((pca >> 16) & 0xFFFF) * PAGES_PER_BLOCK + (pca & 0xFFFF);
+
+    for (uint32_t node = index < PHYSICAL_NAND_NUM * PAGES_PER_BLOCK ? dev->ref_head[index] : REF_NONE;
+         node != REF_NONE; node = dev->ref_next[node])
+    {
+        if (node < dev->total_lbas && node != skip)
+        {
+            return node;
+        }
+    }
+    return dev->total_lbas;
+}
+
+// Drop an LBA from the page it is mapped to, the page turns invalid once no LBA is left in it
+static void ftl_unmap_page(struct ssd_dev* dev, size_t lba)
+{
+    unsigned int pca = dev->L2P[lba];
+    size_t index = ((pca >> 16) & 0xFFFF) * PAGES_PER_BLOCK + (pca & 0xFFFF);
+
+    if (index >= PHYSICAL_NAND_NUM * PAGES_PER_BLOCK)
+    {
+        return;
+    }
+    ref_unlink(dev, lba, pca);
+    if (dev->page_refs[index] > 1)
+    {
+        // P2L of a page shared by deduplicated LBAs names one that is still mapped to it, or SNAP_LBA
+        // once only snapshots hold the page
+        dev->page_refs[index]--;
+        if (dev->P2L[index] == lba)
+        {
+            size_t ref = ftl_find_ref(dev, pca, lba);
+            dev->P2L[index] = ref < dev->total_lbas ? ref : SNAP_LBA;
+        }
+        return;
+    }
+    dev->page_refs[index] = 0;
+    if (dev->page_valid[index] != -1)
+    {
+        ftl_printf(dev, "set block %d page %d invalid\n", (pca >> 16) & 0xFFFF, pca & 0xFFFF);
+        dev->page_valid[index] = -1;
+        dev->P2L[index] = INVALID_LBA;
+    }
+}
+
+// Point an LBA at a page in the mapping tables, return 1 if it is the first LBA the page holds
+static int ftl_map_tables(struct ssd_dev* dev, size_t lba, unsigned int pca, uint32_t slice)
+{
+    size_t index = ((pca >> 16) & 0xFFFF) * PAGES_PER_BLOCK + (pca & 0xFFFF);
+
+    if (dev->L2P[lba] != INVALID_PCA)
+    {
+        ftl_unmap_page(dev, lba);
+    }
+    dev->L2P[lba] = pca;
+    dev->L2P_slice[lba] = slice;
+    ref_link(dev, lba, pca);
+    dev->P2L[index] = slice != 0 ? PACKED_LBA : lba;
+    dev->page_valid[index] = 1;
+    return dev->page_refs[index]++ == 0;
+}
+
+// Drop the mapping of an LBA from the tables, it reads as zeros again
+static void ftl_unmap_tables(struct ssd_dev* dev, size_t lba)
+{
+    if (dev->L2P[lba] != INVALID_PCA)
+    {
+        ftl_unmap_page(dev, lba);
+    }
+    dev->L2P[lba] = INVALID_PCA;
+    dev->L2P_slice[lba] = 0;
+}
+
+// Drop the reference entry i of a snapshot holds on a page, the page turns invalid once nothing is left in it
+static void snap_unref(struct ssd_dev* dev, struct ssd_snapshot* snap, size_t i)
+{
+    unsigned int pca = snap->L2P[i];
+    size_t index = ((pca >> 16) & 0xFFFF) * PAGES_PER_BLOCK + (pca & 0xFFFF);
+
+    if (pca == INVALID_PCA || index >= PHYSICAL_NAND_NUM * PAGES_PER_BLOCK)
+    {
+        return;
+    }
+    ref_unlink(dev, snap_node(dev, snap, i), pca);
+    if (dev->page_refs[index] == 0)
+    {
+        return;
+    }
+    if (--dev->page_refs[index] == 0 && dev->page_valid[index] != -1)
+    {
+        ftl_printf(dev, "set block %d page %d invalid\n", (pca >> 16) & 0xFFFF, pca & 0xFFFF);
+        dev->page_valid[index] = -1;
+        dev->P2L[index] = INVALID_LBA;
+    }
+}
+
+// Point entry i of a snapshot at a page, return 1 if it is the first reference the page holds
+static int snap_map(struct ssd_dev* dev, struct ssd_snapshot* snap, size_t i, unsigned int pca, uint32_t slice)
+{
+    size_t index = ((pca >> 16) & 0xFFFF) * PAGES_PER_BLOCK + (pca & 0xFFFF);
+
+    snap_unref(dev, snap, i);
+    snap->L2P[i] = pca;
+    snap->L2P_slice[i] = slice;
+    ref_link(dev, snap_node(dev, snap, i), pca);
+    dev->page_valid[index] = 1;
+    if (dev->page_refs[index]++ != 0)
+    {
+        return 0;
+    }
+    dev->P2L[index] = slice != 0 ? PACKED_LBA : SNAP_LBA;
+    return 1;
+}
+
+// Snapshot the mapping of a volume into a free slot, its entries take references on the pages of the volume
+static void snap_take(struct ssd_dev* dev, struct ssd_snapshot* snap, unsigned int vol)
+{
+    struct ssd_volume* v = &dev->vols[vol];
+
+    memcpy(snap->L2P, dev->L2P + v->base, v->lbas * sizeof(*snap->L2P));
+    memcpy(snap->L2P_slice, dev->L2P_slice + v->base, v->lbas * sizeof(*snap->L2P_slice));
+    for (size_t i = 0; i < v->lbas; i++)
+    {
+        if (snap->L2P[i] != INVALID_PCA)
+        {
+            dev->page_refs[(snap->L2P[i] >> 16) * PAGES_PER_BLOCK + (snap->L2P[i] & 0xFFFF)]++;
+            ref_link(dev, snap_node(dev, snap, i), snap->L2P[i]);
+        }
+    }
+    snap->vol = vol;
+    snap->logic_size = v->logic_size;
+}
+
+// Release a snapshot slot, the pages only it held turn invalid
+static void snap_drop(struct ssd_dev* dev, struct ssd_snapshot* snap)
+{
+    for (size_t i = 0; i < dev->vols[0].lbas; i++)
+    {
+        snap_unref(dev, snap, i);
+        snap->L2P[i] = INVALID_PCA;
+        snap->L2P_slice[i] = 0;
+    }
+    snap->vol = SNAP_FREE;
+    snap->logic_size = 0;
+}
+
+// Map every LBA of a volume as a table of a snapshot or of another volume does, they then share their pages
+static void ftl_map_volume(struct ssd_dev* dev, struct ssd_volume* vol, const unsigned int* L2P, const uint32_t* L2P_slice)
+{
+    for (size_t i = 0; i < vol->lbas; i++)
+    {
+        size_t lba = vol->base + i;
+
+        if (L2P[i] == INVALID_PCA)
+        {
+            ftl_unmap_tables(dev, lba);
+        }
+        else if (dev->L2P[lba] != L2P[i] || dev->L2P_slice[lba] != L2P_slice[i])
+        {
+            ftl_map_tables(dev, lba, L2P[i], L2P_slice[i]);
+        }
+    }
+}
+
+// Roll a volume back to a snapshot, or clone the snapshot into it if it was taken of another volume
+static void snap_restore(struct ssd_dev* dev, struct ssd_volume* vol, const struct ssd_snapshot* snap)
+{
+    ftl_map_volume(dev, vol, snap->L2P, snap->L2P_slice);
+    vol->logic_size = snap->logic_size;
+}
+
+// Clone volume src into volume vol, the LBAs of both share their pages until they are overwritten
+static void ftl_clone(struct ssd_dev* dev, struct ssd_volume* vol, const struct ssd_volume* src)
+{
+    ftl_map_volume(dev, vol, dev->L2P + src->base, dev->L2P_slice + src->base);
+    vol->logic_size = src->logic_size;
+}
+
+// Release every snapshot slot without touching the pages, the reference counts are rebuilt after it
+static void snap_reset(struct ssd_dev* dev)
+{
+    for (size_t snap = 0; snap < SSD_SNAPSHOT_MAX; snap++)
+    {
+        dev->snaps[snap].vol = SNAP_FREE;
+        dev->snaps[snap].logic_size = 0;
+    }
+    for (size_t i = 0; i < SSD_SNAPSHOT_MAX * dev->vols[0].lbas; i++)
+    {
+        dev->snap_L2P[i] = INVALID_PCA;
+        dev->snap_slice[i] = 0;
+    }
+}
+
+// Read the header of a packed page, return the number of LBAs in it or -1 if it is malformed
+static int pack_parse(struct ssd_dev* dev, const char* page, struct pack_slot* slots)
+{
+    const struct pack_hdr* hdr = (const struct pack_hdr*)page;
+
+    if (hdr->count == 0 || hdr->count > PACK_MAX_SLOTS)
+    {
+        return -1;
+    }
+    for (uint32_t i = 0; i < hdr->count; i++)
+    {
+        slots[i] = hdr->slot[i];
+        if ((slots[i].lba >= dev->total_lbas && slots[i].lba != SNAP_LBA) || slots[i].length == 0 ||
+            slots[i].offset < PACK_HDR_SIZE(hdr->count) || slots[i].offset + slots[i].length > 512)
+        {
+            return -1;
+        }
+    }
+    return hdr->count;
+}
+
+// Find an LBA mapped to a slice of a packed page, SNAP_LBA if only snapshot entries are, total_lbas if nothing is
+static size_t ftl_find_slice(struct ssd_dev* dev, unsigned int pca, uint32_t slice)
+{
+    size_t index = ((pca >> 16) & 0xFFFF) * PAGES_PER_BLOCK + (pca & 0xFFFF);
+    size_t found = dev->total_lbas;
+
+    for (uint32_t node = index < PHYSICAL_NAND_NUM * PAGES_PER_BLOCK ? dev->ref_head[index] : REF_NONE;
+         node != REF_NONE; node = dev->ref_next[node])
+    {
+        if (node < dev->total_lbas && dev->L2P_slice[node] == slice)
+        {
+            return node;
+        }
+        if (node >= dev->total_lbas && dev->snap_slice[node - dev->total_lbas] == slice)
+        {
+            found = SNAP_LBA;
+        }
+    }
+    return found;
+}
+
+// Drop the data nothing is mapped to any more from a copy of a packed page, return how many slots are left.
+// The data of the remaining slots only moves towards the start of the page, in place.
+// old_slices receives the slice every remaining slot had in the original page.
+static int pack_compact(struct ssd_dev* dev, char* page, unsigned int pca, uint32_t* old_slices)
+{
+    struct pack_hdr* hdr = (struct pack_hdr*)page;
+    struct pack_slot slots[PACK_MAX_SLOTS];
+    int count = pack_parse(dev, page, slots);
+    int live = 0;
+    size_t offset;
+
+    for (int i = 0; i < count; i++)
+    {
+        uint32_t slice = SLICE(slots[i].offset, slots[i].length);
+        size_t lba = slots[i].lba;
+
+        // Deduplicated data outlives the LBA it was written for, the slot then names another one,
+        // or SNAP_LBA if only snapshots still hold it
+        if (lba == SNAP_LBA || dev->L2P[lba] != pca || dev->L2P_slice[lba] != slice)
+        {
+            lba = ftl_find_slice(dev, pca, slice);
+            if (lba == dev->total_lbas)
+            {
+                continue;
+            }
+        }
+        slots[i].lba = lba;
+        old_slices[live] = slice;
+        slots[live++] = slots[i];
+    }
+
+    offset = PACK_HDR_SIZE(live);
+    for (int i = 0; i < live; i++)
+    {
+        memmove(page + offset, page + slots[i].offset, slots[i].length);
+        slots[i].offset = offset;
+        offset += slots[i].length;
+    }
+    hdr->count = live;
+    memcpy(hdr->slot, slots, live * sizeof(*slots));
+    memset(page + offset, 0, 512 - offset);
+    return live;
+}
+
+// FTL read operation
+static int ftl_read(struct ssd_dev* dev, char* buf, size_t lba)
+{
+    // Check if LBA is out of range
+    if (lba >= dev->total_lbas)
+    {
+        printf("Invalid PCA: Out of Index Range!\n");
+        return -EINVAL;
+    }
+    else
+    {
+        PCA_RULE pca;
+        // Get the PCA corresponding to LBA
+        pca.pca = dev->L2P[lba]; 
+
+        // If PCA is invalid, it means that the data does not exist
+        if (pca.pca == INVALID_PCA)
+        {
+            printf("Invalid PCA: Data does not exist!\n");
+            return -EINVAL;
+        }
+
+        // A compressed LBA needs a page of its own to be read into
+        if (dev->L2P_slice[lba] != 0)
+        {
+            return ftl_read_pages(dev, buf, 1, lba) < 0 ? -EIO : 512;
+        }
+
+        // Read data from NAND
+        if (nand_read(dev, buf, pca.pca) != 512)
+        {
+            printf("NAND read failed!\n");
+            return -EIO;
+        }
+
+        // Return the number of bytes read
+        return 512;
+    }
+}
+
+// Request of a batch that reads packed page pca, count if there is none yet
+static size_t ftl_find_packed(const struct nand_req* reqs, size_t count, unsigned int pca)
+{
+    size_t i;
+    for (i = 0; i < count && (reqs[i].lba != PACKED_LBA || reqs[i].pca != pca); i++)
+        ;
+    return i;
+}
+
+// FTL read of a range of LBAs, issued to NAND as one batch, unwritten LBAs read as zeros.
+// Compressed LBAs are read into pages of their own, once per packed page, and decompressed after the batch.
+static int ftl_read_pages(struct ssd_dev* dev, char* buf, size_t lba_range, size_t lba)
+{
+    struct nand_req* reqs;
+    size_t count = 0, packed = 0, pages = 0;
+    char* pack_buf = NULL;
+    int ret;
+
+    if (lba + lba_range > dev->total_lbas)
+    {
+        printf("Invalid LBA: Out of range!\n");
+        return -EINVAL;
+    }
+
+    reqs = calloc(lba_range, sizeof(*reqs));
+    if (reqs == NULL)
+    {
+        return -ENOMEM;
+    }
+    // Room for a page per compressed LBA, fewer are read when several share a page
+    for (size_t idx = 0; idx < lba_range; idx++)
+    {
+        pages += dev->L2P[lba + idx] != INVALID_PCA && dev->L2P_slice[lba + idx] != 0;
+    }
+    if (pages != 0 && (pack_buf = page_pool_get(dev, pages)) == NULL)
+    {
+        free(reqs);
+        return -ENOMEM;
+    }
+
+    for (size_t idx = 0; idx < lba_range; idx++)
+    {
+        if (dev->L2P[lba + idx] == INVALID_PCA)
+        {
+            memset(buf + idx * 512, 0x00, 512); // Assuming unread pages return 0x00
+            continue;
+        }
+        if (dev->L2P_slice[lba + idx] != 0)
+        {
+            if (ftl_find_packed(reqs, count, dev->L2P[lba + idx]) < count)
+            {
+                continue;
+            }
+            reqs[count].lba = PACKED_LBA;
+            reqs[count].buf = pack_buf + packed++ * 512;
+        }
+        else
+        {
+            reqs[count].buf = buf + idx * 512;
+        }
+        reqs[count].op = NAND_OP_READ;
+        reqs[count].pca = dev->L2P[lba + idx];
+        count++;
+    }
+
+    ret = nand_submit(dev, reqs, count);
+    if (ret < 0)
+    {
+        printf("NAND read failed!\n");
+    }
+
+    for (size_t idx = 0; ret >= 0 && idx < lba_range; idx++)
+    {
+        uint32_t slice = dev->L2P_slice[lba + idx];
+
+        if (dev->L2P[lba + idx] == INVALID_PCA || slice == 0)
+        {
+            continue;
+        }
+        const struct nand_req* req = &reqs[ftl_find_packed(reqs, count, dev->L2P[lba + idx])];
+        if (lz_decompress((unsigned char*)req->buf + SLICE_OFFSET(slice), SLICE_LENGTH(slice),
+                          (unsigned char*)buf + idx * 512, 512) != 0)
+        {
+            printf("Corrupted compressed data at nand read pca = %d\n", req->pca);
+            ret = -EIO;
+        }
+    }
+    page_pool_put(dev, pack_buf, pages);
+    free(reqs);
+    return ret;
+}
+
+// Point an LBA at a freshly programmed page and record it so it survives a remount
+static void ftl_map(struct ssd_dev* dev, size_t lba, unsigned int pca, uint64_t seq, uint32_t slice)
+{
+    PCA_RULE my_pca;
+    my_pca.pca = pca;
+
+    // Update L2P and P2L mapping, a packed page is counted once for all its LBAs
+    if (ftl_map_tables(dev, lba, pca, slice))
+    {
+        // Increase physical size
+        dev->physic_size++;
+    }
+    ftl_printf(dev, "Updated L2P[%zu] = 0x%X\n", lba, pca);
+
+    // Record the new mapping so it survives a remount
+    journal_append(dev, JRNL_MAP, lba, pca, seq, slice);
+
+    ftl_printf(dev, "block %d, page %d is mapping to %zu\n", my_pca.fields.block, my_pca.fields.page, lba);
+}
+
+// Program a batch of allocated pages and map every one that reached NAND
+static int ftl_program(struct ssd_dev* dev, struct nand_req* reqs, size_t count)
+{
+    int ret = nand_submit(dev, reqs, count);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        if (reqs[i].result == 512 && reqs[i].lba == PACKED_LBA)
+        {
+            struct pack_slot slots[PACK_MAX_SLOTS];
+            int packed = pack_parse(dev, reqs[i].buf, slots);
+            for (int j = 0; j < packed; j++)
+            {
+                if (slots[j].lba != SNAP_LBA)
+                {
+                    ftl_map(dev, slots[j].lba, reqs[i].pca, reqs[i].oob.seq, SLICE(slots[j].offset, slots[j].length));
+                }
+            }
+        }
+        // The entries of snapshots are moved to data GC copied by the caller
+        else if (reqs[i].result == 512 && reqs[i].lba != SNAP_LBA)
+        {
+            ftl_map(dev, reqs[i].lba, reqs[i].pca, reqs[i].oob.seq, 0);
+        }
+        else if (reqs[i].result != 512)
+        {
+            // The page stays invalid, it holds no data the FTL can use until it is erased
+            printf(" --> Write fail !!!\n");
+        }
+    }
+    return ret;
+}
+
+// Pages of a block up to the last one programmed or allocated, the write pointer of the zone it backs
+static size_t zns_block_wp(struct ssd_dev* dev, size_t block)
+{
+    size_t wp = 0;
+    for (size_t page = 0; page < PAGES_PER_BLOCK; page++)
+    {
+        if (dev->page_valid[block * PAGES_PER_BLOCK + page] != 0)
+        {
+            wp = page + 1;
+        }
+    }
+    return wp;
+}
+
+// Zoned write of pages, every LBA goes to its own page in the block of its zone.
+// The host only appends to zones and resets them itself, so there is never anything for GC to do.
+static int zns_write_pages(struct ssd_dev* dev, struct nand_req* reqs, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        if (reqs[i].lba >= dev->total_lbas || dev->zones[reqs[i].lba / PAGES_PER_BLOCK].block < 0)
+        {
+            printf("Invalid LBA: not in an open zone!\n");
+            ftl_program(dev, reqs, i);
+            return -EINVAL;
+        }
+
+        PCA_RULE pca;
+        pca.fields.block = dev->zones[reqs[i].lba / PAGES_PER_BLOCK].block;
+        pca.fields.page = reqs[i].lba % PAGES_PER_BLOCK;
+        ftl_printf(dev, "Allocated PCA: block %u, page %u\n", pca.fields.block, pca.fields.page);
+
+        dev->page_valid[pca.fields.block * PAGES_PER_BLOCK + pca.fields.page] = -1;
+        reqs[i].op = NAND_OP_PROGRAM;
+        reqs[i].pca = pca.pca;
+    }
+    return ftl_program(dev, reqs, count);
+}
+
+// Whether the stream of a volume is at the end of its block
+static int stream_at_end(struct ssd_dev* dev, unsigned int vol)
+{
+    PCA_RULE* stream = &dev->vols[vol].stream;
+    size_t index = stream->fields.block * PAGES_PER_BLOCK + stream->fields.page;
+
+    return stream->pca == INVALID_PCA || stream->fields.page + 1 >= PAGES_PER_BLOCK || dev->gc_victim[stream->fields.block] ||
+           dev->page_valid[index] == 0 || dev->page_valid[index + 1] != 0;
+}
+
+// Whether the stream of the volume of a request has to open a block while none is erased, GC had better free one
+static int stream_blocked(struct ssd_dev* dev, const struct nand_req* req)
+{
+    if (dev->cfg.volumes < 2 || !stream_at_end(dev, ftl_req_volume(dev, req)))
+    {
+        return 0;
+    }
+    for (size_t block = dev->cfg.slc_blocks; block < PHYSICAL_NAND_NUM; block++)
+    {
+        if (!dev->gc_victim[block] && zns_block_wp(dev, block) == 0)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Get the next free page of the write stream of a volume. A volume fills blocks of its own, so data of different
+// volumes only shares a block once no erased block is left to open, it then goes after the last page of any block.
+static unsigned int stream_next_pca(struct ssd_dev* dev, unsigned int vol)
+{
+    PCA_RULE* stream = &dev->vols[vol].stream;
+    size_t erased = PHYSICAL_NAND_NUM, partial = PHYSICAL_NAND_NUM;
+
+    // Go on right after the last page of the stream, unless its block was erased or another stream took the page
+    if (!stream_at_end(dev, vol))
+    {
+        stream->fields.page++;
+        ftl_printf(dev, "Allocated PCA: block %u, page %u, volume %u\n", stream->fields.block, stream->fields.page, vol);
+        return stream->pca;
+    }
+
+    // Open the erased block worn the least
+    for (size_t block = dev->cfg.slc_blocks; block < PHYSICAL_NAND_NUM; block++)
+    {
+        size_t wp = zns_block_wp(dev, block);
+        if (dev->gc_victim[block] || wp == PAGES_PER_BLOCK)
+        {
+            continue;
+        }
+        if (wp == 0 && (erased == PHYSICAL_NAND_NUM || dev->erase_counts[block] < dev->erase_counts[erased]))
+        {
+            erased = block;
+        }
+        else if (wp != 0 && partial == PHYSICAL_NAND_NUM)
+        {
+            partial = block;
+        }
+    }
+    if (erased == PHYSICAL_NAND_NUM)
+    {
+        if (partial == PHYSICAL_NAND_NUM)
+        {
+            ftl_printf(dev, "No new PCA available, SSD is full\n");
+            return FULL_PCA;
+        }
+        erased = partial;
+        for (size_t other = 0; other < dev->cfg.volumes; other++)
+        {
+            if (other != vol && dev->vols[other].stream.pca != INVALID_PCA && dev->vols[other].stream.fields.block == partial)
+            {
+                stats_add(dev, vol[vol].shared_pages, 1);
+                break;
+            }
+        }
+    }
+
+    stream->pca = (erased << 16) | zns_block_wp(dev, erased);
+    ftl_printf(dev, "Allocated PCA: block %u, page %u, volume %u\n", stream->fields.block, stream->fields.page, vol);
+    return stream->pca;
+}
+
+// Get the next page to program the data of a request to
+static unsigned int ftl_next_pca(struct ssd_dev* dev, const struct nand_req* req)
+{
+    return dev->cfg.volumes > 1 ? stream_next_pca(dev, ftl_req_volume(dev, req)) : get_next_pca(dev);
+}
+
+// Give every volume back the block it was writing to, the partially written block whose last data is of the volume
+static void stream_mount(struct ssd_dev* dev)
+{
+    for (size_t vol = 0; vol < dev->cfg.volumes; vol++)
+    {
+        dev->vols[vol].stream.pca = INVALID_PCA;
+    }
+    for (size_t block = dev->cfg.slc_blocks; block < PHYSICAL_NAND_NUM && dev->cfg.volumes > 1; block++)
+    {
+        size_t wp = zns_block_wp(dev, block);
+
+        for (size_t page = wp; page-- > 0 && wp < PAGES_PER_BLOCK; )
+        {
+            unsigned int pca = (block << 16) | page;
+            size_t lba = dev->P2L[block * PAGES_PER_BLOCK + page];
+
+            if (lba == PACKED_LBA)
+            {
+                lba = ftl_find_ref(dev, pca, dev->total_lbas);
+            }
+            if (lba >= dev->total_lbas)
+            {
+                continue;
+            }
+            if (dev->vols[ftl_lba_volume(dev, lba)].stream.pca == INVALID_PCA)
+            {
+                dev->vols[ftl_lba_volume(dev, lba)].stream.pca = (block << 16) | (wp - 1);
+            }
+            break;
+        }
+    }
+}
+
+// FTL write of pages for arbitrary LBAs, the pages are allocated up front and programmed as one batch.
+// Each request needs buf and lba filled in. Pending programs are flushed before GC runs,
+// so GC never sees a page that is allocated but not yet programmed.
+static int ftl_write_pages(struct ssd_dev* dev, struct nand_req* reqs, size_t count)
+{
+    size_t pending = 0; // First request not yet submitted
+    int ret;
+
+    if (dev->cfg.zns)
+    {
+        return zns_write_pages(dev, reqs, count);
+    }
+
+    // A host write pays its share of GC before it takes any page, except for the pages the SLC cache takes
+    if (!dev->GC_flag)
+    {
+        if (dev->cfg.slc_blocks && count_slc_free_pages(dev) < count)
+        {
+            slc_reclaim(dev);
+        }
+        size_t cached = dev->cfg.slc_blocks ? count_slc_free_pages(dev) : 0;
+        ftl_gc_pace(dev, count > cached ? count - cached : 0);
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        // Check if LBA is out of range, a packed page carries its LBAs in its header
+        // and GC moves data only snapshots hold without any
+        if (reqs[i].lba >= dev->total_lbas && reqs[i].lba != PACKED_LBA && reqs[i].lba != SNAP_LBA)
+        {
+            printf("Invalid LBA: Out of range!\n");
+            ftl_program(dev, reqs + pending, i - pending);
+            return -EINVAL;
+        }
+
+        // Host writes land in the SLC cache while it has room, GC and folding write to the main blocks
+        PCA_RULE pca;
+        pca.pca = dev->GC_flag ? FULL_PCA : slc_next_pca(dev);
+        if (!dev->GC_flag && dev->cfg.slc_blocks)
+        {
+            if (pca.pca != FULL_PCA)
+                stats_add(dev, slc_host_pages, 1);
+            else
+                stats_add(dev, slc_bypass_pages, 1);
+        }
+
+        // Keep enough free pages for GC to relocate whatever it still has to move,
+        // and an erased block for the stream of a volume to go on in
+        if (pca.pca == FULL_PCA && !dev->GC_flag &&
+            (count_free_pages(dev) < ftl_gc_reserve(dev) || stream_blocked(dev, reqs + i)))
+        {
+            if ((ret = ftl_program(dev, reqs + pending, i - pending)) < 0)
+            {
+                return ret;
+            }
+            pending = i;
+            // Pages snapshots hold may leave GC nothing to collect, the reserve must then stay
+            // whole so GC can still relocate a victim once they are deleted
+            if (ftl_gc(dev) != 0 && count_free_pages(dev) < ftl_gc_reserve(dev))
+            {
+                printf("No space left for host writes!\n");
+                return -ENOSPC;
+            }
+        }
+
+        // Get the next available PCA
+        if (pca.pca == FULL_PCA)
+        {
+            pca.pca = ftl_next_pca(dev, reqs + i);
+        }
+        // If SSD is full, try garbage collection
+        if (pca.pca == FULL_PCA)
+        {
+            if ((ret = ftl_program(dev, reqs + pending, i - pending)) < 0)
+            {
+                return ret;
+            }
+            pending = i;
+
+            ftl_printf(dev, "SSD is full, attempting garbage collection...\n");
+            if (ftl_gc(dev) != 0)
+            {
+                printf("Garbage collection failed, cannot write data!\n");
+                return -ENOMEM;
+            }
+
+            // Reacquire PCA
+            pca.pca = ftl_next_pca(dev, reqs + i);
+            if (pca.pca == FULL_PCA)
+            {
+                printf("No available PCA after garbage collection!\n");
+                return -ENOMEM;
+            }
+        }
+
+        // An allocated page counts as invalid until its program completes
+        dev->page_valid[pca.fields.block * PAGES_PER_BLOCK + pca.fields.page] = -1;
+        reqs[i].op = NAND_OP_PROGRAM;
+        reqs[i].pca = pca.pca;
+    }
+
+    return ftl_program(dev, reqs + pending, count - pending);
+}
+
+// FTL write of a contiguous range of LBAs with compression. Runs of LBAs that compress to
+// PACK_MAX_LEN or less are packed into pages, the others are written as they are.
+static int ftl_write_compressed(struct ssd_dev* dev, const char* buf, size_t lba_range, size_t lba)
+{
+    struct nand_req* reqs = calloc(lba_range, sizeof(*reqs));
+    unsigned char* cdata = malloc(lba_range * PACK_MAX_LEN);
+    size_t* clen = calloc(lba_range, sizeof(*clen));
+    char* pack_buf = page_pool_get(dev, (lba_range + 1) / 2);
+    size_t count = 0, packs = 0, packed_lbas = 0;
+    int ret = -ENOMEM;
+
+    if (reqs == NULL || cdata == NULL || clen == NULL || pack_buf == NULL)
+    {
+        goto out;
+    }
+    for (size_t idx = 0; idx < lba_range; idx++)
+    {
+        clen[idx] = lz_compress((const unsigned char*)buf + idx * 512, 512, cdata + idx * PACK_MAX_LEN, PACK_MAX_LEN);
+    }
+
+    for (size_t idx = 0; idx < lba_range; )
+    {
+        // Take the longest run starting here that fits one page
+        size_t run = 0, used = 0;
+        while (idx + run < lba_range && run < PACK_MAX_SLOTS && clen[idx + run] != 0 &&
+               PACK_HDR_SIZE(run + 1) + used + clen[idx + run] <= 512)
+        {
+            used += clen[idx + run];
+            run++;
+        }
+        if (run < 2)
+        {
+            reqs[count].buf = (char*)buf + idx * 512;
+            reqs[count].lba = lba + idx;
+            count++;
+            idx++;
+            continue;
+        }
+
+        char* page = pack_buf + packs++ * 512;
+        struct pack_hdr* hdr = (struct pack_hdr*)page;
+        size_t offset = PACK_HDR_SIZE(run);
+        memset(page, 0, 512);
+        hdr->count = run;
+        for (size_t i = 0; i < run; i++)
+        {
+            hdr->slot[i].lba = lba + idx + i;
+            hdr->slot[i].offset = offset;
+            hdr->slot[i].length = clen[idx + i];
+            memcpy(page + offset, cdata + (idx + i) * PACK_MAX_LEN, clen[idx + i]);
+            offset += clen[idx + i];
+        }
+        reqs[count].buf = page;
+        reqs[count].lba = PACKED_LBA;
+        count++;
+        packed_lbas += run;
+        idx += run;
+    }
+
+    ret = ftl_write_pages(dev, reqs, count);
+    if (ret >= 0)
+    {
+        stats_add(dev, packed_pages, packs);
+        stats_add(dev, packed_lbas, packed_lbas);
+        ret = lba_range * 512;
+    }
+out:
+    page_pool_put(dev, pack_buf, (lba_range + 1) / 2);
+    free(reqs);
+    free(cdata);
+    free(clen);
+    return ret;
+}
+
+// FTL write of a contiguous range of LBAs, every one to NAND
+static int ftl_write_range(struct ssd_dev* dev, const char* buf, size_t lba_range, size_t lba)
+{
+    struct nand_req* reqs;
+    int ret;
+
+    if (dev->cfg.compress)
+    {
+        return ftl_write_compressed(dev, buf, lba_range, lba);
+    }
+
+    reqs = calloc(lba_range, sizeof(*reqs));
+    if (reqs == NULL)
+    {
+        return -ENOMEM;
+    }
+    for (size_t idx = 0; idx < lba_range; idx++)
+    {
+        reqs[idx].buf = (char*)buf + idx * 512;
+        reqs[idx].lba = lba + idx;
+    }
+
+    ret = ftl_write_pages(dev, reqs, lba_range);
+    free(reqs);
+    if (ret < 0)
+    {
+        return ret;
+    }
+    return lba_range * 512;
+}
+
+// Nonzero if a page holds zeros only
+static int page_is_zero(const char* data)
+{
+    return data[0] == 0 && memcmp(data, data + 1, 511) == 0;
+}
+
+// Find data identical to an LBA already on NAND through the fingerprint index, 0 if it is there.
+// page needs room for two pages, the one read and the LBA decompressed from it.
+static int dedup_lookup(struct ssd_dev* dev, const char* data, uint64_t hash, char* page, unsigned int* pca, uint32_t* slice)
+{
+    const struct dedup_entry* entry = &dev->dedup_index[hash % DEDUP_INDEX_SIZE];
+    size_t block = (entry->pca >> 16) & 0xFFFF;
+    size_t index = block * PAGES_PER_BLOCK + (entry->pca & 0xFFFF);
+    const char* found = page;
+
+    // A block being collected may already be past the page, mapping to it would be lost on erase
+    if (entry->pca == INVALID_PCA || entry->hash != hash || index >= PHYSICAL_NAND_NUM * PAGES_PER_BLOCK ||
+        dev->page_valid[index] != 1 || dev->gc_victim[block])
+    {
+        return -1;
+    }
+
+    // The page may have been erased and written again since, only the data itself tells
+    if (nand_read(dev, page, entry->pca) != 512)
+    {
+        return -1;
+    }
+    if (entry->slice != 0)
+    {
+        if (SLICE_OFFSET(entry->slice) + SLICE_LENGTH(entry->slice) > 512 ||
+            lz_decompress((unsigned char*)page + SLICE_OFFSET(entry->slice), SLICE_LENGTH(entry->slice),
+                          (unsigned char*)page + 512, 512) != 0)
+        {
+            return -1;
+        }
+        found = page + 512;
+    }
+    if (memcmp(found, data, 512) != 0)
+    {
+        return -1;
+    }
+    *pca = entry->pca;
+    *slice = entry->slice;
+    return 0;
+}
+
+// Map an LBA to data that is already on NAND
+static void ftl_map_dedup(struct ssd_dev* dev, size_t lba, unsigned int pca, uint32_t slice)
+{
+    if (dev->L2P[lba] != pca || dev->L2P_slice[lba] != slice)
+    {
+        ftl_map(dev, lba, pca, ++dev->write_seq, slice);
+    }
+}
+
+#define DEDUP_ZERO   ((size_t)-1) // The LBA is all zeros
+#define DEDUP_MAPPED ((size_t)-2) // The LBA was found through the fingerprint index
+
+// FTL write of a contiguous range of LBAs with deduplication. All-zero LBAs are unmapped without touching NAND,
+// LBAs whose data is already on NAND or earlier in the range are mapped to it, the others are written in runs.
+static int ftl_write_dedup(struct ssd_dev* dev, const char* buf, size_t lba_range, size_t lba)
+{
+    uint64_t* hash = malloc(lba_range * sizeof(*hash));
+    size_t* source = malloc(lba_range * sizeof(*source)); // The LBA of the range whose data it takes
+    char* page = page_pool_get(dev, 2);
+    size_t dedup = 0, zero = 0, end;
+    int ret = -ENOMEM;
+
+    if (hash == NULL || source == NULL || page == NULL)
+    {
+        goto out;
+    }
+
+    for (size_t idx = 0; idx < lba_range; idx++)
+    {
+        const char* data = buf + idx * 512;
+        unsigned int pca;
+        uint32_t slice;
+
+        if (page_is_zero(data))
+        {
+            if (dev->L2P[lba + idx] != INVALID_PCA)
+            {
+                ftl_unmap_tables(dev, lba + idx);
+                journal_append(dev, JRNL_UNMAP, lba + idx, 0, ++dev->write_seq, 0);
+            }
+            source[idx] = DEDUP_ZERO;
+            zero++;
+            continue;
+        }
+
+        hash[idx] = xxh64(data, 512, 0);
+        source[idx] = idx;
+        for (size_t i = 0; i < idx; i++)
+        {
+            if (source[i] == i && hash[i] == hash[idx] && memcmp(buf + i * 512, data, 512) == 0)
+            {
+                source[idx] = i;
+                break;
+            }
+        }
+        if (source[idx] == idx && dedup_lookup(dev, data, hash[idx], page, &pca, &slice) == 0)
+        {
+            ftl_map_dedup(dev, lba + idx, pca, slice);
+            source[idx] = DEDUP_MAPPED;
+        }
+        dedup += source[idx] != idx;
+    }
+
+    // Write the new data and remember where it went
+    for (size_t idx = 0; idx < lba_range; idx = end)
+    {
+        for (end = idx; end < lba_range && source[end] == end; end++)
+            ;
+        if (end == idx)
+        {
+            end++;
+            continue;
+        }
+        ret = ftl_write_range(dev, buf + idx * 512, end - idx, lba + idx);
+        if (ret < 0)
+        {
+            goto out;
+        }
+        for (size_t i = idx; i < end; i++)
+        {
+            struct dedup_entry* entry = &dev->dedup_index[hash[i] % DEDUP_INDEX_SIZE];
+            entry->hash = hash[i];
+            entry->pca = dev->L2P[lba + i];
+            entry->slice = dev->L2P_slice[lba + i];
+        }
+    }
+
+    // Copies of data written by this request share its pages
+    for (size_t idx = 0; idx < lba_range; idx++)
+    {
+        if (source[idx] < idx && dev->L2P[lba + source[idx]] != INVALID_PCA)
+        {
+            ftl_map_dedup(dev, lba + idx, dev->L2P[lba + source[idx]], dev->L2P_slice[lba + source[idx]]);
+        }
+    }
+
+    stats_add(dev, dedup_lbas, dedup);
+    stats_add(dev, zero_lbas, zero);
+    ret = lba_range * 512;
+out:
+    page_pool_put(dev, page, 2);
+    free(hash);
+    free(source);
+    return ret;
+}
+
+// FTL write operation of a contiguous range of LBAs
+static int ftl_write(struct ssd_dev* dev, const char* buf, size_t lba_range, size_t lba)
+{
+    if (dev->cfg.dedup)
+    {
+        return ftl_write_dedup(dev, buf, lba_range, lba);
+    }
+    return ftl_write_range(dev, buf, lba_range, lba);
+}
+
+// Counts the number of invalid pages in the specified block
+static size_t count_invalid_pages(struct ssd_dev* dev, size_t block)
+{
+    size_t invalid_pages = 0;
+    for (size_t page = 0; page < PAGES_PER_BLOCK ; page++)
+    {
+        size_t index = block * PAGES_PER_BLOCK + page;
+        if(dev->page_valid[index] == -1)
+            invalid_pages++;
+    }
+    return invalid_pages;
+}
+
+// Counts the number of valid pages in the specified block
+static size_t count_valid_pages(struct ssd_dev* dev, size_t block)
+{
+    size_t valid_pages = 0;
+    for (size_t page = 0; page < PAGES_PER_BLOCK; page++)
+    {
+        if (dev->page_valid[block * PAGES_PER_BLOCK + page] == 1)
+            valid_pages++;
+    }
+    return valid_pages;
+}
+
+// Counts the free pages the allocator may still hand out, those of the SLC cache are for host writes only
+static size_t count_free_pages(struct ssd_dev* dev)
+{
+    size_t free_pages = 0;
+    for (size_t block = dev->cfg.slc_blocks; block < PHYSICAL_NAND_NUM; block++)
+    {
+        if (dev->gc_victim[block])
+            continue;
+        for (size_t page = 0; page < PAGES_PER_BLOCK; page++)
+        {
+            free_pages += dev->page_valid[block * PAGES_PER_BLOCK + page] == 0;
+        }
+    }
+    return free_pages;
+}
+
+// Counts the free pages of the SLC cache
+static size_t count_slc_free_pages(struct ssd_dev* dev)
+{
+    size_t free_pages = 0;
+    for (size_t block = 0; block < dev->cfg.slc_blocks; block++)
+    {
+        if (dev->gc_victim[block])
+            continue;
+        for (size_t page = 0; page < SLC_PAGES_PER_BLOCK; page++)
+        {
+            free_pages += dev->page_valid[block * PAGES_PER_BLOCK + page] == 0;
+        }
+    }
+    return free_pages;
+}
+
+// Select the block with the most invalid pages
+static int select_block_for_gc(struct ssd_dev* dev)
+{
+    int block_to_erase = -1;
+    size_t max_invalid_pages = 0;
+    size_t min_erase_count = SIZE_MAX;
+
+    // Erasing a block of the SLC cache frees no room for relocations, the cache is emptied by folding
+    for (size_t block = dev->cfg.slc_blocks; block < PHYSICAL_NAND_NUM; block++)
+    {
+        // A block already being collected cannot be selected again by a nested GC
+        if (dev->gc_victim[block])
+        {
+            continue;
+        }
+
+        size_t invalid_pages = count_invalid_pages(dev, block);
+        if (invalid_pages > max_invalid_pages)
+        {
+             // Prefer blocks with more invalid pages
+            max_invalid_pages = invalid_pages;
+            block_to_erase = block;
+            min_erase_count = dev->erase_counts[block];
+        }
+        else if (invalid_pages == max_invalid_pages && dev->erase_counts[block] < min_erase_count)
+        {
+            // If multiple blocks have the same number of invalid pages, choose the one with lower erase count
+            block_to_erase = block;
+            min_erase_count = dev->erase_counts[block];
+        }
+        ftl_printf(dev, "In Block %zu founded %zu invalid pages\n", block, invalid_pages);
+    }
+
+    // Erasing a block without invalid pages gains nothing
+    if (block_to_erase != -1 && max_invalid_pages > 0)
+    {
+        return block_to_erase;
+    }
+    else
+    {
+        // No block suitable for erasing
+        return -1;
+    }
+}
+
+
+// Let host reads waiting for the device go first, return 1 if any ran.
+// Only a writer, holding wlock, steps aside, so the FTL state readers see is always mapped.
+static int sched_yield_to_reads(struct ssd_dev* dev)
+{
+    int yielded = 0;
+
+    while (__atomic_load_n(&dev->reads_waiting, __ATOMIC_ACQUIRE) > 0)
+    {
+        pthread_cond_wait(&dev->reads_drained, &dev->lock);
+        yielded = 1;
+    }
+    return yielded;
+}
+
+// Slice a relocated packed page has for data that had old_slice in the old page, 0 if the page is not packed
+static uint32_t ftl_gc_slice(const struct pack_slot* slots, int count, const uint32_t* old_slices, uint32_t old_slice)
+{
+    int i;
+
+    for (i = 0; i < count && old_slices[i] != old_slice; i++)
+        ;
+    return i < count ? SLICE(slots[i].offset, slots[i].length) : 0;
+}
+
+// LBAs deduplicated into a page GC relocated and the entries of snapshots follow it to its new copy.
+// Data that had old_slices[i] in the old page is in slots[i] of the new one, count is 0 if it is not packed.
+static void ftl_gc_move_refs(struct ssd_dev* dev, unsigned int old_pca, const struct nand_req* req,
+                             const struct pack_slot* slots, int count, const uint32_t* old_slices)
+{
+    size_t index = ((old_pca >> 16) & 0xFFFF) * PAGES_PER_BLOCK + (old_pca & 0xFFFF);
+
+    if (req->result != 512 || dev->page_refs[index] == 0)
+    {
+        return;
+    }
+    // Mapping a node to the new page takes it off the list of the old one
+    for (uint32_t node = dev->ref_head[index], next; node != REF_NONE; node = next)
+    {
+        next = dev->ref_next[node];
+        if (node < dev->total_lbas)
+        {
+            ftl_map(dev, node, req->pca, req->oob.seq, ftl_gc_slice(slots, count, old_slices, dev->L2P_slice[node]));
+            continue;
+        }
+
+        size_t s = (node - dev->total_lbas) / dev->vols[0].lbas;
+        size_t i = (node - dev->total_lbas) % dev->vols[0].lbas;
+        uint32_t slice = ftl_gc_slice(slots, count, old_slices, dev->snaps[s].L2P_slice[i]);
+        if (snap_map(dev, &dev->snaps[s], i, req->pca, slice))
+        {
+            dev->physic_size++;
+        }
+        journal_append(dev, JRNL_SNAP_MAP, i, req->pca, s, slice);
+    }
+}
+
+// Pack the page of an LBA GC just read with the next valid pages of the victim, as long as they are LBAs of
+// the same volume that compress into the page too. Small host writes get a page each, they share one once
+// GC moves them. Returns 1 once they were relocated, 0 if fewer than two fit and the page moves as it is.
+static int ftl_gc_pack(struct ssd_dev* dev, struct gc_run* gc, const struct nand_req* first)
+{
+    unsigned char cdata[PACK_MAX_SLOTS][PACK_MAX_LEN];
+    size_t clen[PACK_MAX_SLOTS];
+    size_t lbas[PACK_MAX_SLOTS];
+    unsigned int old_pcas[PACK_MAX_SLOTS];
+    const uint32_t old_slice = 0;
+    unsigned int vol = ftl_lba_volume(dev, first->lba);
+    size_t count = 1, used, offset;
+    struct nand_req req;
+    char* page;
+
+    clen[0] = lz_compress((const unsigned char*)first->buf, 512, cdata[0], PACK_MAX_LEN);
+    if (clen[0] == 0 || (page = page_pool_get(dev, 1)) == NULL)
+    {
+        return 0;
+    }
+    lbas[0] = first->lba;
+    old_pcas[0] = first->pca;
+    used = clen[0];
+
+    // A page that does not fit any more is left to the next step
+    while (count < PACK_MAX_SLOTS && gc->page < PAGES_PER_BLOCK)
+    {
+        size_t index = gc->victim * PAGES_PER_BLOCK + gc->page;
+        size_t lba = dev->P2L[index];
+
+        if (dev->page_valid[index] != 1)
+        {
+            gc->page++;
+            continue;
+        }
+        if (lba >= dev->total_lbas || ftl_lba_volume(dev, lba) != vol)
+        {
+            break;
+        }
+        memset(&req, 0, sizeof(req));
+        req.op = NAND_OP_READ;
+        req.pca = (gc->victim << 16) | gc->page;
+        req.buf = page;
+        req.lba = lba;
+        if (nand_submit(dev, &req, 1) < 0)
+        {
+            break;
+        }
+        clen[count] = lz_compress((const unsigned char*)page, 512, cdata[count], PACK_MAX_LEN);
+        if (clen[count] == 0 || PACK_HDR_SIZE(count + 1) + used + clen[count] > 512)
+        {
+            break;
+        }
+        lbas[count] = lba;
+        old_pcas[count] = req.pca;
+        used += clen[count++];
+        gc->page++;
+    }
+    if (count < 2)
+    {
+        page_pool_put(dev, page, 1);
+        return 0;
+    }
+
+    struct pack_hdr* hdr = (struct pack_hdr*)page;
+    memset(page, 0, 512);
+    hdr->count = count;
+    offset = PACK_HDR_SIZE(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        hdr->slot[i].lba = lbas[i];
+        hdr->slot[i].offset = offset;
+        hdr->slot[i].length = clen[i];
+        memcpy(page + offset, cdata[i], clen[i]);
+        offset += clen[i];
+    }
+
+    // Mapping the packed page invalidates the pages the LBAs came from
+    memset(&req, 0, sizeof(req));
+    req.buf = page;
+    req.lba = PACKED_LBA;
+    if (ftl_write_pages(dev, &req, 1) < 0)
+    {
+        printf("Failed to write data to new PCA during GC.\n");
+        page_pool_put(dev, page, 1);
+        return -EIO;
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        ftl_gc_move_refs(dev, old_pcas[i], &req, &hdr->slot[i], 1, &old_slice);
+    }
+    page_pool_put(dev, page, 1);
+    stats_add(dev, packed_pages, 1);
+    stats_add(dev, packed_lbas, count);
+    gc->relocated += count;
+    return 1;
+}
+
+// Relocate the next valid page of the victim, or erase it once none is left.
+// Returns 1 while pages remain, 0 once the victim is erased, -EIO on failure.
+static int ftl_gc_step(struct ssd_dev* dev, struct gc_run* gc)
+{
+    struct nand_req req;
+    struct pack_slot slots[PACK_MAX_SLOTS];
+    uint32_t old_slices[PACK_MAX_SLOTS];
+    unsigned int old_pca;
+    int count, ret;
+
+    while (gc->page < PAGES_PER_BLOCK)
+    {
+        size_t page = gc->page++;
+        size_t index = gc->victim * PAGES_PER_BLOCK + page;
+
+        if (dev->page_valid[index] != 1)
+        {
+            continue;
+        }
+
+        // Use P2L mapping table to find the corresponding LBA
+        size_t lba = dev->P2L[index];
+        if (lba == INVALID_LBA)
+        {
+            printf("No corresponding LBA found for PCA (%d, %zu).\n", gc->victim, page);
+            continue;
+        }
+
+        // Read valid data from NAND
+        memset(&req, 0, sizeof(req));
+        req.op = NAND_OP_READ;
+        req.pca = (gc->victim << 16) | page;
+        req.buf = gc->page_buf;
+        req.lba = lba;
+        if (nand_submit(dev, &req, 1) < 0)
+        {
+            printf("Failed to read data during GC.\n");
+            return -EIO;
+        }
+
+        // Only the LBAs still mapped to a packed page move, packed again without the others
+        if (lba == PACKED_LBA && pack_compact(dev, gc->page_buf, req.pca, old_slices) <= 0)
+        {
+            continue;
+        }
+        if (dev->cfg.compress && lba < dev->total_lbas && (ret = ftl_gc_pack(dev, gc, &req)) != 0)
+        {
+            return ret < 0 ? -EIO : 1;
+        }
+
+        // Write it to a new PCA, mapping it invalidates the old one
+        old_pca = req.pca;
+        if (ftl_write_pages(dev, &req, 1) < 0)
+        {
+            printf("Failed to write data to new PCA during GC.\n");
+            return -EIO;
+        }
+        count = lba == PACKED_LBA ? pack_parse(dev, req.buf, slots) : 0;
+        ftl_gc_move_refs(dev, old_pca, &req, slots, count, old_slices);
+        gc->relocated++;
+        return 1;
+    }
+
+    // Erase block
+    if (nand_erase(dev, gc->victim) != 1)
+    {
+        printf("Failed to erase block %d during GC.\n", gc->victim);
+        return -EIO;
+    }
+    return 0;
+}
+
+// Valid pages the GC run still has to relocate
+static size_t ftl_gc_remaining(struct ssd_dev* dev, const struct gc_run* gc)
+{
+    size_t valid = 0;
+
+    for (size_t page = gc->page; page < PAGES_PER_BLOCK; page++)
+    {
+        valid += dev->page_valid[gc->victim * PAGES_PER_BLOCK + page] == 1;
+    }
+    return valid;
+}
+
+// Set up a GC run of victim
+static int ftl_gc_begin(struct ssd_dev* dev, struct gc_run* gc, int victim)
+{
+    memset(gc, 0, sizeof(*gc));
+    gc->start = now_ns(CLOCK_MONOTONIC);
+    gc->page_buf = page_pool_get(dev, 1);
+    if (gc->page_buf == NULL)
+    {
+        gc->victim = -1;
+        return -ENOMEM;
+    }
+
+    ftl_printf(dev, "Selected block %d for garbage collection.\n", victim);
+    gc->victim = victim;
+    dev->gc_victim[victim] = 1;
+    return 0;
+}
+
+// Release the victim of a GC run, ret is the result of its last step
+static int ftl_gc_end(struct ssd_dev* dev, struct gc_run* gc, int ret)
+{
+    int victim = gc->victim;
+
+    page_pool_put(dev, gc->page_buf, 1);
+    gc->page_buf = NULL;
+    gc->victim = -1;
+    dev->gc_victim[victim] = 0;
+    if (ret < 0)
+    {
+        return -EIO;
+    }
+
+    ftl_printf(dev, "Garbage collection for block %d completed successfully.\n", victim);
+    dev->gc_count++;
+    stats_add(dev, gc_count, 1);
+    stats_add(dev, gc_pages_relocated, gc->relocated);
+    stats_lat_add(dev, SSD_LAT_GC, now_ns(CLOCK_MONOTONIC) - gc->start);
+    return 0;
+}
+
+// FTL garbage collection of a whole block, host reads may run between the relocation of two pages
+static int ftl_gc(struct ssd_dev* dev)
+{
+    struct gc_run local;
+    struct gc_run* gc = &local;
+    int outer_gc = dev->GC_flag;
+    int ret;
+
+    // A host write out of space finishes the paced GC first, it is the closest to freeing a block
+    if (!outer_gc && dev->gc_paced.victim >= 0)
+    {
+        gc = &dev->gc_paced;
+    }
+    else
+    {
+        int victim = select_block_for_gc(dev);
+        if (victim == -1)
+        {
+            ftl_printf(dev, "No suitable block found for garbage collection.\n");
+            return -EINVAL;
+        }
+        if ((ret = ftl_gc_begin(dev, gc, victim)) < 0)
+        {
+            return ret;
+        }
+    }
+
+    dev->GC_flag = 1;
+    while ((ret = ftl_gc_step(dev, gc)) > 0)
+    {
+        if (sched_yield_to_reads(dev))
+        {
+            stats_add(dev, gc_preemptions, 1);
+        }
+    }
+    dev->GC_flag = outer_gc;
+    return ftl_gc_end(dev, gc, ret);
+}
+
+// Free pages host writes must leave to GC. A paced GC only needs room for the pages it
+// still has to move, otherwise a whole block is kept so any victim can be relocated.
+static size_t ftl_gc_reserve(struct ssd_dev* dev)
+{
+    if (dev->gc_paced.victim >= 0)
+    {
+        return ftl_gc_remaining(dev, &dev->gc_paced) + 1;
+    }
+    return PAGES_PER_BLOCK;
+}
+
+// Pay the GC work owed by a host write of count pages, so GC keeps pace with the host
+// instead of collecting a whole block at once when free space hits the reserve.
+// Free pages are credits that host writes and relocations both spend, and the victim must
+// be erased before they run out. Every host page therefore owes the remaining steps of the
+// victim, its valid pages and the erase, divided by the host pages still left before that.
+static void ftl_gc_pace(struct ssd_dev* dev, size_t count)
+{
+    struct gc_run* gc = &dev->gc_paced;
+    size_t free_pages, remaining, credits;
+    int ret;
+
+    if (!dev->cfg.gc_pace)
+    {
+        return;
+    }
+    free_pages = count_free_pages(dev);
+
+    // Take a victim as late as possible, a later one has had more time to collect invalid pages
+    if (gc->victim < 0)
+    {
+        if (free_pages > 2 * PAGES_PER_BLOCK)
+        {
+            return;
+        }
+        int victim = select_block_for_gc(dev);
+        if (victim == -1)
+        {
+            return;
+        }
+        remaining = count_valid_pages(dev, victim);
+        if (free_pages > PAGES_PER_BLOCK && free_pages - remaining - 1 > GC_PACE_STEPS * (remaining + 1))
+        {
+            return;
+        }
+        if (ftl_gc_begin(dev, gc, victim) < 0)
+        {
+            return;
+        }
+        dev->gc_debt = 0;
+    }
+
+    // Without credits left the reserve check collects the rest at once
+    remaining = ftl_gc_remaining(dev, gc);
+    if (free_pages <= remaining + 1)
+    {
+        return;
+    }
+    credits = free_pages - remaining - 1;
+    dev->gc_debt += count * GC_PACE_UNIT * (remaining + 1) / credits;
+
+    dev->GC_flag = 1;
+    while (dev->gc_debt >= GC_PACE_UNIT)
+    {
+        dev->gc_debt -= GC_PACE_UNIT;
+        if ((ret = ftl_gc_step(dev, gc)) <= 0)
+        {
+            // The debt was priced for this victim, the next one sets its own rate
+            ftl_gc_end(dev, gc, ret);
+            dev->gc_debt = 0;
+            break;
+        }
+        if (sched_yield_to_reads(dev))
+        {
+            stats_add(dev, gc_preemptions, 1);
+        }
+    }
+    dev->GC_flag = 0;
+}
+
+// SLC cache block to fold next, the one holding the most programmed pages, -1 once the cache is empty
+static int fold_select(struct ssd_dev* dev)
+{
+    int victim = -1;
+    size_t most = 0;
+
+    for (size_t block = 0; block < dev->cfg.slc_blocks; block++)
+    {
+        size_t used = 0;
+
+        if (dev->gc_victim[block])
+        {
+            continue;
+        }
+        for (size_t page = 0; page < PAGES_PER_BLOCK; page++)
+        {
+            used += dev->page_valid[block * PAGES_PER_BLOCK + page] != 0;
+        }
+        if (used > most)
+        {
+            most = used;
+            victim = block;
+        }
+    }
+    return victim;
+}
+
+// Fold the next valid page of the SLC cache into the main blocks, or erase a cache block once nothing is left in it.
+// Returns 1 while there may be more to fold, 0 once the cache is empty, -EIO on failure.
+static int ftl_fold_step(struct ssd_dev* dev)
+{
+    struct gc_run* fold = &dev->fold;
+    int victim, ret;
+
+    if (fold->victim < 0)
+    {
+        victim = fold_select(dev);
+        if (victim < 0)
+        {
+            return 0;
+        }
+        if ((ret = ftl_gc_begin(dev, fold, victim)) < 0)
+        {
+            return ret;
+        }
+    }
+
+    // Folding spends free pages of the main blocks, like a host write it leaves GC its reserve
+    if (count_free_pages(dev) <= ftl_gc_reserve(dev) && ftl_gc(dev) != 0)
+    {
+        return 0;
+    }
+
+    // Folding relocates like GC does, so the pages go to the main blocks
+    dev->GC_flag = 1;
+    ret = ftl_gc_step(dev, fold);
+    dev->GC_flag = 0;
+    if (ret > 0)
+    {
+        return 1;
+    }
+
+    victim = fold->victim;
+    stats_add(dev, slc_folded_pages, fold->relocated);
+    page_pool_put(dev, fold->page_buf, 1);
+    fold->page_buf = NULL;
+    fold->victim = -1;
+    dev->gc_victim[victim] = 0;
+    if (ret < 0)
+    {
+        return -EIO;
+    }
+    stats_add(dev, slc_folds, 1);
+    ftl_printf(dev, "Folded SLC cache block %d\n", victim);
+    return 1;
+}
+
+// Checksum of a journal record, computed with the crc field cleared
+static uint32_t journal_rec_crc(const struct journal_rec* rec)
+{
+    struct journal_rec tmp = *rec;
+    tmp.crc = 0;
+    return crc32c_update(0, &tmp, sizeof(tmp));
+}
+
+// Append a record describing a metadata change to the journal
+static void journal_append(struct ssd_dev* dev, uint32_t type, uint32_t arg0, uint32_t arg1, uint64_t arg2, uint64_t arg3)
+{
+    struct journal_rec rec;
+
+    if (dev->journal_fp == NULL || dev->power_lost)
+    {
+        return;
+    }
+
+    memset(&rec, 0, sizeof(rec));
+    rec.type = type;
+    rec.arg0 = arg0;
+    rec.arg1 = arg1;
+    rec.arg2 = arg2;
+    rec.arg3 = arg3;
+    rec.crc = journal_rec_crc(&rec);
+
+    if (fwrite(&rec, sizeof(rec), 1, dev->journal_fp) != 1 || fflush(dev->journal_fp) != 0)
+    {
+        printf("Failed to append journal record type %u\n", type);
+        return;
+    }
+    dev->journal_records++;
+}
+
+// Start an empty journal belonging to the checkpoint generation gen
+static int journal_reset(struct ssd_dev* dev, uint64_t gen)
+{
+    char path[PATH_MAX];
+    struct journal_hdr hdr;
+
+    if (dev->journal_fp != NULL)
+    {
+        fclose(dev->journal_fp);
+        dev->journal_fp = NULL;
+    }
+
+    dev->journal_gen = gen;
+    dev->journal_records = 0;
+    if (dev->cfg.nand_dir == NULL)
+    {
+        return 0;
+    }
+
+    snprintf(path, sizeof(path), "%s/%s", dev->cfg.nand_dir, JOURNAL_NAME);
+    if ( !(dev->journal_fp = fopen(path, "w")))
+    {
+        printf("Failed to create journal %s\n", path);
+        return -EIO;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = JOURNAL_MAGIC;
+    hdr.gen = gen;
+    if (fwrite(&hdr, sizeof(hdr), 1, dev->journal_fp) != 1 || fflush(dev->journal_fp) != 0)
+    {
+        printf("Failed to write journal header %s\n", path);
+        return -EIO;
+    }
+
+    dev->journal_gen = gen;
+    dev->journal_records = 0;
+    return 0;
+}
+
+// Write a full checkpoint of the FTL state and start a new journal
+static int ckpt_write(struct ssd_dev* dev)
+{
+    char path[PATH_MAX], tmp_path[PATH_MAX + 8];
+    size_t total_pages = PHYSICAL_NAND_NUM * PAGES_PER_BLOCK;
+    size_t snap_entries = SSD_SNAPSHOT_MAX * dev->vols[0].lbas;
+    struct ckpt_hdr hdr;
+    FILE* fptr;
+
+    // A NAND kept in memory does not outlive the process, there is nothing to checkpoint
+    if (dev->cfg.nand_dir == NULL)
+    {
+        return journal_reset(dev, dev->journal_gen + 1);
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = CKPT_MAGIC;
+    hdr.version = CKPT_VERSION;
+    hdr.nand_num = PHYSICAL_NAND_NUM;
+    hdr.pages_per_block = PAGES_PER_BLOCK;
+    hdr.total_lbas = dev->total_lbas;
+    hdr.curr_pca = dev->curr_pca.pca;
+    hdr.gen = dev->journal_gen + 1;
+    hdr.physic_size = dev->physic_size;
+    hdr.volumes = dev->cfg.volumes;
+    for (size_t vol = 0; vol < dev->cfg.volumes; vol++)
+    {
+        hdr.logic_size[vol] = dev->vols[vol].logic_size;
+    }
+    hdr.host_write_size = dev->host_write_size;
+    hdr.nand_write_size = dev->nand_write_size;
+    hdr.write_seq = dev->write_seq;
+    for (size_t block = 0; block < PHYSICAL_NAND_NUM; block++)
+    {
+        hdr.erase_counts[block] = dev->erase_counts[block];
+    }
+    for (size_t snap = 0; snap < SSD_SNAPSHOT_MAX; snap++)
+    {
+        hdr.snap_volume[snap] = dev->snaps[snap].vol;
+        hdr.snap_logic_size[snap] = dev->snaps[snap].logic_size;
+    }
+
+    hdr.crc = crc32c_update(0, &hdr, sizeof(hdr));
+    hdr.crc = crc32c_update(hdr.crc, dev->L2P, dev->total_lbas * sizeof(*dev->L2P));
+    hdr.crc = crc32c_update(hdr.crc, dev->P2L, total_pages * sizeof(*dev->P2L));
+    hdr.crc = crc32c_update(hdr.crc, dev->page_valid, total_pages * sizeof(*dev->page_valid));
+    hdr.crc = crc32c_update(hdr.crc, dev->L2P_slice, dev->total_lbas * sizeof(*dev->L2P_slice));
+    hdr.crc = crc32c_update(hdr.crc, dev->snap_L2P, snap_entries * sizeof(*dev->snap_L2P));
+    hdr.crc = crc32c_update(hdr.crc, dev->snap_slice, snap_entries * sizeof(*dev->snap_slice));
+
+    // Write to a temporary file first so a crash never leaves a torn checkpoint
+    snprintf(path, sizeof(path), "%s/%s", dev->cfg.nand_dir, CKPT_NAME);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    if ( !(fptr = fopen(tmp_path, "w")))
+    {
+        printf("Failed to create checkpoint %s\n", tmp_path);
+        return -EIO;
+    }
+    if (fwrite(&hdr, sizeof(hdr), 1, fptr) != 1 ||
+        fwrite(dev->L2P, sizeof(*dev->L2P), dev->total_lbas, fptr) != dev->total_lbas ||
+        fwrite(dev->P2L, sizeof(*dev->P2L), total_pages, fptr) != total_pages ||
+        fwrite(dev->page_valid, sizeof(*dev->page_valid), total_pages, fptr) != total_pages ||
+        fwrite(dev->L2P_slice, sizeof(*dev->L2P_slice), dev->total_lbas, fptr) != dev->total_lbas ||
+        fwrite(dev->snap_L2P, sizeof(*dev->snap_L2P), snap_entries, fptr) != snap_entries ||
+        fwrite(dev->snap_slice, sizeof(*dev->snap_slice), snap_entries, fptr) != snap_entries ||
+        fflush(fptr) != 0 || fsync(fileno(fptr)) != 0)
+    {
+        printf("Failed to write checkpoint %s\n", tmp_path);
+        fclose(fptr);
+        return -EIO;
+    }
+    fclose(fptr);
+
+    if (rename(tmp_path, path) != 0)
+    {
+        printf("Failed to commit checkpoint %s\n", path);
+        return -EIO;
+    }
+
+    ftl_printf(dev, "Checkpoint generation %llu written\n", (unsigned long long)hdr.gen);
+
+    // Records in the old journal are now covered by the checkpoint
+    return journal_reset(dev, hdr.gen);
+}
+
+// Take a new checkpoint once the journal has grown long enough
+static void ftl_maybe_checkpoint(struct ssd_dev* dev)
+{
+    if (dev->journal_records >= JOURNAL_CKPT_LIMIT && !dev->power_lost)
+    {
+        ckpt_write(dev);
+    }
+}
+
+// Load the last checkpoint into the FTL tables, return its generation or 0
+static uint64_t ckpt_load(struct ssd_dev* dev)
+{
+    char path[PATH_MAX];
+    size_t total_pages = PHYSICAL_NAND_NUM * PAGES_PER_BLOCK;
+    size_t snap_entries = SSD_SNAPSHOT_MAX * dev->vols[0].lbas;
+    struct ckpt_hdr hdr;
+    uint32_t crc, stored_crc;
+    FILE* fptr;
+    int ok;
+
+    if (dev->cfg.nand_dir == NULL)
+    {
+        return 0;
+    }
+    snprintf(path, sizeof(path), "%s/%s", dev->cfg.nand_dir, CKPT_NAME);
+    if ( !(fptr = fopen(path, "r")))
+    {
+        ftl_printf(dev, "No checkpoint found at %s\n", path);
+        return 0;
+    }
+
+    ok = fread(&hdr, sizeof(hdr), 1, fptr) == 1 &&
+         hdr.magic == CKPT_MAGIC &&
+         hdr.version == CKPT_VERSION &&
+         hdr.nand_num == PHYSICAL_NAND_NUM &&
+         hdr.pages_per_block == PAGES_PER_BLOCK &&
+         hdr.total_lbas == dev->total_lbas &&
+         hdr.volumes == dev->cfg.volumes &&
+         fread(dev->L2P, sizeof(*dev->L2P), dev->total_lbas, fptr) == dev->total_lbas &&
+         fread(dev->P2L, sizeof(*dev->P2L), total_pages, fptr) == total_pages &&
+         fread(dev->page_valid, sizeof(*dev->page_valid), total_pages, fptr) == total_pages &&
+         fread(dev->L2P_slice, sizeof(*dev->L2P_slice), dev->total_lbas, fptr) == dev->total_lbas &&
+         fread(dev->snap_L2P, sizeof(*dev->snap_L2P), snap_entries, fptr) == snap_entries &&
+         fread(dev->snap_slice, sizeof(*dev->snap_slice), snap_entries, fptr) == snap_entries;
+    fclose(fptr);
+    if (!ok)
+    {
+        printf("Checkpoint %s is unusable\n", path);
+        return 0;
+    }
+
+    stored_crc = hdr.crc;
+    hdr.crc = 0;
+    crc = crc32c_update(0, &hdr, sizeof(hdr));
+    crc = crc32c_update(crc, dev->L2P, dev->total_lbas * sizeof(*dev->L2P));
+    crc = crc32c_update(crc, dev->P2L, total_pages * sizeof(*dev->P2L));
+    crc = crc32c_update(crc, dev->page_valid, total_pages * sizeof(*dev->page_valid));
+    crc = crc32c_update(crc, dev->L2P_slice, dev->total_lbas * sizeof(*dev->L2P_slice));
+    crc = crc32c_update(crc, dev->snap_L2P, snap_entries * sizeof(*dev->snap_L2P));
+    crc = crc32c_update(crc, dev->snap_slice, snap_entries * sizeof(*dev->snap_slice));
+    if (crc != stored_crc)
+    {
+        printf("Checkpoint %s checksum mismatch\n", path);
+        return 0;
+    }
+
+    // Page reference counts and lists are not stored, every mapped LBA and snapshot entry holds one on its page
+    memset(dev->page_refs, 0, total_pages * sizeof(*dev->page_refs));
+    memset(dev->ref_head, 0xFF, total_pages * sizeof(*dev->ref_head));
+    for (size_t lba = 0; lba < dev->total_lbas; lba++)
+    {
+        size_t index = (dev->L2P[lba] >> 16) * PAGES_PER_BLOCK + (dev->L2P[lba] & 0xFFFF);
+        if (dev->L2P[lba] != INVALID_PCA && index < total_pages)
+        {
+            dev->page_refs[index]++;
+            ref_link(dev, lba, dev->L2P[lba]);
+        }
+    }
+    for (size_t snap = 0; snap < SSD_SNAPSHOT_MAX; snap++)
+    {
+        dev->snaps[snap].vol = hdr.snap_volume[snap] < dev->cfg.volumes ? hdr.snap_volume[snap] : SNAP_FREE;
+        dev->snaps[snap].logic_size = hdr.snap_logic_size[snap];
+        for (size_t i = 0; i < dev->vols[0].lbas; i++)
+        {
+            unsigned int pca = dev->snaps[snap].L2P[i];
+            size_t index = (pca >> 16) * PAGES_PER_BLOCK + (pca & 0xFFFF);
+            if (dev->snaps[snap].vol != SNAP_FREE && pca != INVALID_PCA && index < total_pages)
+            {
+                dev->page_refs[index]++;
+                ref_link(dev, snap_node(dev, &dev->snaps[snap], i), pca);
+            }
+        }
+    }
+
+    dev->curr_pca.pca = hdr.curr_pca;
+    dev->physic_size = hdr.physic_size;
+    for (size_t vol = 0; vol < dev->cfg.volumes; vol++)
+    {
+        dev->vols[vol].logic_size = hdr.logic_size[vol];
+    }
+    dev->host_write_size = hdr.host_write_size;
+    dev->nand_write_size = hdr.nand_write_size;
+    dev->write_seq = hdr.write_seq;
+    for (size_t block = 0; block < PHYSICAL_NAND_NUM; block++)
+    {
+        dev->erase_counts[block] = hdr.erase_counts[block];
+    }
+
+    return hdr.gen;
+}
+
+// Apply one journal record to the in-memory FTL state
+static int journal_apply(struct ssd_dev* dev, const struct journal_rec* rec)
+{
+    size_t total_pages = PHYSICAL_NAND_NUM * PAGES_PER_BLOCK;
+
+    switch (rec->type)
+    {
+        case JRNL_MAP:
+        {
+            PCA_RULE pca;
+            size_t lba = rec->arg0;
+            size_t new_index;
+
+            pca.pca = rec->arg1;
+            new_index = pca.fields.block * PAGES_PER_BLOCK + pca.fields.page;
+            if (lba >= dev->total_lbas || new_index >= total_pages)
+            {
+                return -EINVAL;
+            }
+
+            // The old page is invalidated once none of its LBAs is left.
+            // Only a freshly programmed main page moves the allocator, deduplicated LBAs map to older ones.
+            if (ftl_map_tables(dev, lba, pca.pca, rec->arg3))
+            {
+                dev->physic_size++;
+                dev->nand_write_size += 512;
+                if (pca.fields.block >= dev->cfg.slc_blocks)
+                {
+                    dev->curr_pca.pca = pca.pca;
+                }
+            }
+            if (rec->arg2 > dev->write_seq)
+            {
+                dev->write_seq = rec->arg2;
+            }
+            return 0;
+        }
+        case JRNL_ERASE:
+            if (rec->arg0 >= PHYSICAL_NAND_NUM)
+            {
+                return -EINVAL;
+            }
+            erase_block_metadata(dev, rec->arg0);
+            return 0;
+        case JRNL_HOST_WRITE:
+            if (rec->arg0 >= dev->cfg.volumes)
+            {
+                return -EINVAL;
+            }
+            dev->host_write_size += rec->arg2;
+            dev->vols[rec->arg0].logic_size = rec->arg3;
+            return 0;
+        case JRNL_RESIZE:
+            if (rec->arg0 >= dev->cfg.volumes)
+            {
+                return -EINVAL;
+            }
+            dev->vols[rec->arg0].logic_size = rec->arg3;
+            return 0;
+        case JRNL_UNMAP:
+            if (rec->arg0 >= dev->total_lbas)
+            {
+                return -EINVAL;
+            }
+            ftl_unmap_tables(dev, rec->arg0);
+            if (rec->arg2 > dev->write_seq)
+            {
+                dev->write_seq = rec->arg2;
+            }
+            return 0;
+        case JRNL_SNAP_MAP:
+        {
+            PCA_RULE pca;
+            size_t new_index;
+
+            pca.pca = rec->arg1;
+            new_index = pca.fields.block * PAGES_PER_BLOCK + pca.fields.page;
+            if (rec->arg2 >= SSD_SNAPSHOT_MAX || dev->snaps[rec->arg2].vol == SNAP_FREE ||
+                rec->arg0 >= dev->vols[0].lbas || new_index >= total_pages)
+            {
+                return -EINVAL;
+            }
+            // Only GC moves snapshot entries, to a page it just programmed
+            if (snap_map(dev, &dev->snaps[rec->arg2], rec->arg0, pca.pca, rec->arg3))
+            {
+                dev->physic_size++;
+                dev->nand_write_size += 512;
+                if (pca.fields.block >= dev->cfg.slc_blocks)
+                {
+                    dev->curr_pca.pca = pca.pca;
+                }
+            }
+            return 0;
+        }
+        case JRNL_SNAP_CREATE:
+            if (rec->arg0 >= SSD_SNAPSHOT_MAX || dev->snaps[rec->arg0].vol != SNAP_FREE || rec->arg1 >= dev->cfg.volumes)
+            {
+                return -EINVAL;
+            }
+            snap_take(dev, &dev->snaps[rec->arg0], rec->arg1);
+            return 0;
+        case JRNL_SNAP_DELETE:
+            if (rec->arg0 >= SSD_SNAPSHOT_MAX || dev->snaps[rec->arg0].vol == SNAP_FREE)
+            {
+                return -EINVAL;
+            }
+            snap_drop(dev, &dev->snaps[rec->arg0]);
+            return 0;
+        case JRNL_SNAP_RESTORE:
+            if (rec->arg0 >= dev->cfg.volumes || rec->arg1 >= SSD_SNAPSHOT_MAX || dev->snaps[rec->arg1].vol == SNAP_FREE)
+            {
+                return -EINVAL;
+            }
+            snap_restore(dev, &dev->vols[rec->arg0], &dev->snaps[rec->arg1]);
+            return 0;
+        case JRNL_CLONE:
+            if (rec->arg0 >= dev->cfg.volumes || rec->arg1 >= dev->cfg.volumes)
+            {
+                return -EINVAL;
+            }
+            ftl_clone(dev, &dev->vols[rec->arg0], &dev->vols[rec->arg1]);
+            return 0;
+    }
+    return -EINVAL;
+}
+
+// Replay the journal tail written after checkpoint generation gen
+static size_t journal_replay(struct ssd_dev* dev, uint64_t gen)
+{
+    char path[PATH_MAX];
+    struct journal_hdr hdr;
+    struct journal_rec rec;
+    size_t replayed = 0;
+    FILE* fptr;
+
+    snprintf(path, sizeof(path), "%s/%s", dev->cfg.nand_dir, JOURNAL_NAME);
+    if ( !(fptr = fopen(path, "r")))
+    {
+        return 0;
+    }
+
+    // A journal from another generation is already covered by the checkpoint
+    if (fread(&hdr, sizeof(hdr), 1, fptr) != 1 || hdr.magic != JOURNAL_MAGIC || hdr.gen != gen)
+    {
+        fclose(fptr);
+        return 0;
+    }
+
+    // Stop at the first torn or corrupted record
+    while (fread(&rec, sizeof(rec), 1, fptr) == 1)
+    {
+        if (rec.crc != journal_rec_crc(&rec) || journal_apply(dev, &rec) != 0)
+        {
+            printf("Journal replay stopped at record %zu\n", replayed);
+            break;
+        }
+        replayed++;
+    }
+    fclose(fptr);
+
+    return replayed;
+}
+
+// The metadata is stale if the page the allocator would hand out next was already programmed
+static int ftl_metadata_stale(struct ssd_dev* dev)
+{
+    PCA_RULE saved = dev->curr_pca;
+    struct nand_oob oob;
+    unsigned int pca;
+
+    // The SLC cache is small and has no cursor in the metadata, any of its free pages may be next
+    for (size_t block = 0; block < dev->cfg.slc_blocks; block++)
+    {
+        for (size_t page = 0; page < SLC_PAGES_PER_BLOCK; page++)
+        {
+            if (dev->page_valid[block * PAGES_PER_BLOCK + page] == 0 &&
+                (nand_read_oob(dev, &oob, (block << 16) | page) != 0 || oob.magic == OOB_MAGIC))
+            {
+                return 1;
+            }
+        }
+    }
+
+    // Zones and the streams of volumes are written side by side, each block has a next page of its own
+    if (dev->cfg.zns || dev->cfg.volumes > 1)
+    {
+        for (size_t block = dev->cfg.slc_blocks; block < PHYSICAL_NAND_NUM; block++)
+        {
+            size_t wp = zns_block_wp(dev, block);
+            if (wp < PAGES_PER_BLOCK &&
+                (nand_read_oob(dev, &oob, (block << 16) | wp) != 0 || oob.magic == OOB_MAGIC))
+            {
+                return 1;
+            }
+        }
+        return 0;
+    }
+
+    pca = get_next_pca(dev);
+    dev->curr_pca = saved;
+    if (pca == FULL_PCA)
+    {
+        return 0;
+    }
+    if (nand_read_oob(dev, &oob, pca) != 0)
+    {
+        return 1;
+    }
+    return oob.magic == OOB_MAGIC;
+}
+
+// Grow every volume over the LBAs mapped in it, a scan only knows the logical sizes the data implies
+static void ftl_volumes_cover(struct ssd_dev* dev)
+{
+    for (size_t lba = 0; lba < dev->total_lbas; lba++)
+    {
+        struct ssd_volume* vol = &dev->vols[ftl_lba_volume(dev, lba)];
+
+        if (dev->L2P[lba] != INVALID_PCA && lba < vol->base + vol->lbas && (lba - vol->base + 1) * 512 > vol->logic_size)
+        {
+            vol->logic_size = (lba - vol->base + 1) * 512;
+        }
+    }
+}
+
+// Scan result of one physical page
+struct scan_page
+{
+    int state;        // 0 erased, 1 programmed, -1 torn or corrupted
+    uint32_t count;   // LBAs in the page, more than one only if it is packed
+    uint32_t lba[PACK_MAX_SLOTS];
+    uint32_t slice[PACK_MAX_SLOTS];
+    uint64_t seq;
+};
+
+// Range of blocks handled by one scan worker
+struct scan_range
+{
+    struct ssd_dev* dev;
+    size_t first_block;
+    size_t last_block;
+    struct scan_page* pages;
+    size_t* erase_max;
+};
+
+// Read the data and OOB of every page in a range of blocks
+static void* scan_worker(void* arg)
+{
+    struct scan_range* range = arg;
+    struct ssd_dev* dev = range->dev;
+    char* data = NULL;
+    struct nand_oob* oob = malloc(PAGES_PER_BLOCK * sizeof(*oob));
+
+    if (posix_memalign((void**)&data, NAND_ALIGN, NAND_BLOCK_SIZE) != 0 || oob == NULL)
+    {
+        free(data);
+        free(oob);
+        return (void*)-1;
+    }
+
+    for (size_t block = range->first_block; block < range->last_block; block++)
+    {
+        // Missing tail of a short file reads as erased
+        memset(data, 0, NAND_BLOCK_SIZE);
+        if (nand_pread(dev, block, data, NAND_BLOCK_SIZE, 0) < 0)
+        {
+            continue;
+        }
+        for (size_t page = 0; page < PAGES_PER_BLOCK; page++)
+        {
+            memcpy(&oob[page], data + OOB_OFFSET(page), sizeof(*oob));
+        }
+
+        for (size_t page = 0; page < PAGES_PER_BLOCK; page++)
+        {
+            struct scan_page* sp = &range->pages[block * PAGES_PER_BLOCK + page];
+
+            if (oob[page].magic != OOB_MAGIC)
+            {
+                sp->state = 0;
+                continue;
+            }
+            if (oob[page].crc != nand_oob_crc(data + page * 512, &oob[page]) ||
+                (oob[page].lba >= dev->total_lbas && oob[page].lba != PACKED_LBA && oob[page].lba != SNAP_LBA))
+            {
+                sp->state = -1;
+                continue;
+            }
+
+            // Data only snapshots held when GC moved it belongs to no LBA, snapshots live in the metadata alone
+            sp->count = 0;
+            if (oob[page].lba == PACKED_LBA)
+            {
+                struct pack_slot slots[PACK_MAX_SLOTS];
+                int packed = pack_parse(dev, data + page * 512, slots);
+                if (packed < 0)
+                {
+                    sp->state = -1;
+                    continue;
+                }
+                for (int i = 0; i < packed; i++)
+                {
+                    if (slots[i].lba != SNAP_LBA)
+                    {
+                        sp->lba[sp->count] = slots[i].lba;
+                        sp->slice[sp->count++] = SLICE(slots[i].offset, slots[i].length);
+                    }
+                }
+            }
+            else if (oob[page].lba != SNAP_LBA)
+            {
+                sp->lba[0] = oob[page].lba;
+                sp->slice[0] = 0;
+                sp->count = 1;
+            }
+            sp->state = 1;
+            sp->seq = oob[page].seq;
+            if (oob[page].erase_count > range->erase_max[block])
+            {
+                range->erase_max[block] = oob[page].erase_count;
+            }
+        }
+    }
+
+    free(data);
+    free(oob);
+    return NULL;
+}
+
+// Scan every page into pages and the largest erase count found in every block into erase_max,
+// blocks are scanned in parallel. Return the number of workers used or -errno.
+static long scan_pages(struct ssd_dev* dev, struct scan_page* pages, size_t* erase_max)
+{
+    struct scan_range ranges[PHYSICAL_NAND_NUM];
+    pthread_t workers[PHYSICAL_NAND_NUM];
+    long workers_num = sysconf(_SC_NPROCESSORS_ONLN);
+    long ret = 0;
+
+    // One worker per contiguous range of blocks
+    if (workers_num < 1)
+    {
+        workers_num = 1;
+    }
+    if (workers_num > PHYSICAL_NAND_NUM)
+    {
+        workers_num = PHYSICAL_NAND_NUM;
+    }
+    for (long w = 0; w < workers_num; w++)
+    {
+        ranges[w].dev = dev;
+        ranges[w].first_block = PHYSICAL_NAND_NUM * w / workers_num;
+        ranges[w].last_block = PHYSICAL_NAND_NUM * (w + 1) / workers_num;
+        ranges[w].pages = pages;
+        ranges[w].erase_max = erase_max;
+        if (pthread_create(&workers[w], NULL, scan_worker, &ranges[w]) != 0)
+        {
+            // Scan this range on the calling thread instead
+            scan_worker(&ranges[w]);
+            workers[w] = 0;
+        }
+    }
+    for (long w = 0; w < workers_num; w++)
+    {
+        void* result = NULL;
+        if (workers[w] != 0)
+        {
+            pthread_join(workers[w], &result);
+        }
+        if (result != NULL)
+        {
+            ret = -ENOMEM;
+        }
+    }
+    return ret != 0 ? ret : workers_num;
+}
+
+// Rebuild L2P, P2L and page_valid from the OOB of every page, scanning blocks in parallel
+static int ftl_scan_recover(struct ssd_dev* dev)
+{
+    size_t total_pages = PHYSICAL_NAND_NUM * PAGES_PER_BLOCK;
+    struct scan_page* pages = calloc(total_pages, sizeof(*pages));
+    size_t* erase_max = calloc(PHYSICAL_NAND_NUM, sizeof(*erase_max));
+    uint64_t* lba_seq = calloc(dev->total_lbas, sizeof(*lba_seq));
+    size_t programmed = 0, valid = 0;
+    uint64_t max_seq = 0, curr_seq = 0;
+    long workers_num;
+
+    if (pages == NULL || erase_max == NULL || lba_seq == NULL ||
+        (workers_num = scan_pages(dev, pages, erase_max)) < 0)
+    {
+        free(pages);
+        free(erase_max);
+        free(lba_seq);
+        return -ENOMEM;
+    }
+
+    // Deduplicated LBAs and those unmapped by an all-zero write have no page of their own, their
+    // mappings are only in the checkpoint and journal. A scan would hand back the older data they
+    // replaced, so a device written with dedup is only mounted from its metadata.
+    for (size_t index = 0; dev->cfg.dedup && index < total_pages; index++)
+    {
+        if (pages[index].state != 0)
+        {
+            printf("No usable checkpoint, dedup mappings cannot be rebuilt by scan (open without dedup to scan anyway)\n");
+            free(pages);
+            free(erase_max);
+            free(lba_seq);
+            return -EIO;
+        }
+    }
+
+    // Keep the newest copy of every LBA, older copies become invalid pages.
+    // Snapshots are in the metadata only, the data only they held is lost with it.
+    for (size_t i = 0; i < dev->total_lbas; i++)
+    {
+        dev->L2P[i] = INVALID_PCA;
+    }
+    snap_reset(dev);
+    for (size_t index = 0; index < total_pages; index++)
+    {
+        struct scan_page* sp = &pages[index];
+
+        dev->P2L[index] = INVALID_LBA;
+        dev->page_valid[index] = sp->state == 0 ? 0 : -1;
+        dev->page_refs[index] = 0;
+        dev->ref_head[index] = REF_NONE;
+        if (sp->state == 0)
+        {
+            continue;
+        }
+        programmed++;
+        if (sp->state != 1)
+        {
+            continue;
+        }
+        if (sp->seq > max_seq)
+        {
+            max_seq = sp->seq;
+        }
+        if (sp->seq > curr_seq && index / PAGES_PER_BLOCK >= dev->cfg.slc_blocks)
+        {
+            curr_seq = sp->seq;
+            dev->curr_pca.fields.block = index / PAGES_PER_BLOCK;
+            dev->curr_pca.fields.page = index % PAGES_PER_BLOCK;
+        }
+        for (uint32_t i = 0; i < sp->count; i++)
+        {
+            uint32_t lba = sp->lba[i];
+            if (dev->L2P[lba] == INVALID_PCA || sp->seq > lba_seq[lba])
+            {
+                ftl_map_tables(dev, lba, ((index / PAGES_PER_BLOCK) << 16) | (index % PAGES_PER_BLOCK), sp->slice[i]);
+                lba_seq[lba] = sp->seq;
+            }
+        }
+    }
+
+    for (size_t lba = 0; lba < dev->total_lbas; lba++)
+    {
+        if (dev->L2P[lba] != INVALID_PCA)
+        {
+            valid++;
+        }
+    }
+    for (size_t block = 0; block < PHYSICAL_NAND_NUM; block++)
+    {
+        if (erase_max[block] > dev->erase_counts[block])
+        {
+            dev->erase_counts[block] = erase_max[block];
+        }
+    }
+    if (max_seq > dev->write_seq)
+    {
+        dev->write_seq = max_seq;
+    }
+    ftl_volumes_cover(dev);
+
+    // The WA counters are not stored per page, keep them at least consistent with the scan
+    dev->physic_size = programmed;
+    if (dev->nand_write_size < programmed * 512)
+    {
+        dev->nand_write_size = programmed * 512;
+    }
+    if (dev->host_write_size < valid * 512)
+    {
+        dev->host_write_size = valid * 512;
+    }
+
+    ftl_printf(dev, "Scan recovered %zu valid LBAs from %zu programmed pages using %ld workers\n",
+           valid, programmed, workers_num);
+
+    free(pages);
+    free(erase_max);
+    free(lba_seq);
+    return 0;
+}
+
+// Order scanned pages by program sequence
+static int scan_seq_cmp(const void* a, const void* b, void* arg)
+{
+    const struct scan_page* pages = arg;
+    uint64_t seq_a = pages[*(const size_t*)a].seq;
+    uint64_t seq_b = pages[*(const size_t*)b].seq;
+
+    return seq_a < seq_b ? -1 : seq_a > seq_b;
+}
+
+// Bring the checkpoint and journal up to date with the pages programmed after their last record.
+// Unlike a full scan it keeps the mappings the metadata alone holds, those of deduplicated and zeroed LBAs.
+static int ftl_roll_forward(struct ssd_dev* dev)
+{
+    size_t total_pages = PHYSICAL_NAND_NUM * PAGES_PER_BLOCK;
+    struct scan_page* pages = calloc(total_pages, sizeof(*pages));
+    size_t* erase_max = calloc(PHYSICAL_NAND_NUM, sizeof(*erase_max));
+    size_t* order = malloc(total_pages * sizeof(*order));
+    size_t programmed = 0, count = 0;
+
+    if (pages == NULL || erase_max == NULL || order == NULL || scan_pages(dev, pages, erase_max) < 0)
+    {
+        free(pages);
+        free(erase_max);
+        free(order);
+        return -ENOMEM;
+    }
+
+    // Pages the metadata still has as free were programmed after it was last written
+    for (size_t index = 0; index < total_pages; index++)
+    {
+        if (dev->page_valid[index] != 0 || pages[index].state == 0)
+        {
+            continue;
+        }
+        programmed++;
+        dev->page_valid[index] = -1;
+        if (pages[index].state == 1)
+        {
+            order[count++] = index;
+        }
+    }
+
+    // Every one of them is newer than any mapping of its LBAs the metadata has
+    qsort_r(order, count, sizeof(*order), scan_seq_cmp, pages);
+    for (size_t i = 0; i < count; i++)
+    {
+        struct scan_page* sp = &pages[order[i]];
+        unsigned int pca = ((order[i] / PAGES_PER_BLOCK) << 16) | (order[i] % PAGES_PER_BLOCK);
+
+        for (uint32_t j = 0; j < sp->count; j++)
+        {
+            ftl_map_tables(dev, sp->lba[j], pca, sp->slice[j]);
+        }
+        if (order[i] / PAGES_PER_BLOCK >= dev->cfg.slc_blocks)
+        {
+            dev->curr_pca.pca = pca;
+        }
+        if (sp->seq > dev->write_seq)
+        {
+            dev->write_seq = sp->seq;
+        }
+    }
+
+    for (size_t block = 0; block < PHYSICAL_NAND_NUM; block++)
+    {
+        if (erase_max[block] > dev->erase_counts[block])
+        {
+            dev->erase_counts[block] = erase_max[block];
+        }
+    }
+    ftl_volumes_cover(dev);
+    dev->physic_size += programmed;
+    dev->nand_write_size += programmed * 512;
+
+    ftl_printf(dev, "Rolled forward %zu pages programmed after the last journal record\n", programmed);
+
+    free(pages);
+    free(erase_max);
+    free(order);
+    return 0;
+}
+
+// Restore the FTL from the last checkpoint and journal, or rebuild it from the OOB of every page
+static int ftl_mount(struct ssd_dev* dev)
+{
+    struct timespec start, end;
+    uint64_t gen;
+    size_t replayed;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if (nand_open(dev) != 0)
+    {
+        return -EIO;
+    }
+
+    gen = ckpt_load(dev);
+    if (gen != 0)
+    {
+        replayed = journal_replay(dev, gen);
+        dev->journal_gen = gen;
+
+        if (!ftl_metadata_stale(dev))
+        {
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            ftl_printf(dev, "Mounted checkpoint generation %llu, replayed %zu journal records in %.3f ms\n",
+                   (unsigned long long)gen, replayed,
+                   (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6);
+
+            // Fold the replayed tail into a fresh checkpoint
+            return ckpt_write(dev);
+        }
+        // Programs the journal missed are newer than all it has, they are added on top of it
+        ftl_printf(dev, "Checkpoint generation %llu is stale, rolling forward\n", (unsigned long long)gen);
+        if (ftl_roll_forward(dev) != 0)
+        {
+            return -EIO;
+        }
+        return ckpt_write(dev);
+    }
+
+    // Without usable metadata, rebuild the tables from the pages themselves
+    if (ftl_scan_recover(dev) != 0)
+    {
+        return -EIO;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    ftl_printf(dev, "Mounted by scan in %.3f ms\n",
+           (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6);
+
+    return ckpt_write(dev);
+}
+
+// Drop all in-memory state as a power loss would, remount and report what survived
+static void powercut_recover(struct ssd_dev* dev)
+{
+    struct timespec start, end;
+    size_t total_pages = PHYSICAL_NAND_NUM * PAGES_PER_BLOCK;
+    size_t checked = 0, lost = 0, rolled_back = 0;
+    char* page_buf;
+
+    if (dev->journal_fp != NULL)
+    {
+        fclose(dev->journal_fp);
+        dev->journal_fp = NULL;
+    }
+    for (size_t i = 0; i < dev->total_lbas; i++)
+    {
+        dev->L2P[i] = INVALID_PCA;
+        dev->L2P_slice[i] = 0;
+    }
+    for (size_t i = 0; i < total_pages; i++)
+    {
+        dev->P2L[i] = INVALID_LBA;
+        dev->page_valid[i] = 0;
+        dev->page_refs[i] = 0;
+        dev->ref_head[i] = REF_NONE;
+    }
+    for (size_t block = 0; block < PHYSICAL_NAND_NUM; block++)
+    {
+        dev->erase_counts[block] = 0;
+    }
+    dev->physic_size = 0;
+    for (size_t vol = 0; vol < dev->cfg.volumes; vol++)
+    {
+        dev->vols[vol].logic_size = 0;
+    }
+    snap_reset(dev);
+    dev->host_write_size = 0;
+    dev->nand_write_size = 0;
+    dev->write_seq = 0;
+    dev->journal_gen = 0;
+    dev->journal_records = 0;
+    dev->curr_pca.pca = INVALID_PCA;
+    dev->GC_flag = 0;
+    if (dev->gc_paced.victim >= 0)
+    {
+        page_pool_put(dev, dev->gc_paced.page_buf, 1);
+        dev->gc_paced.victim = -1;
+    }
+    if (dev->fold.victim >= 0)
+    {
+        page_pool_put(dev, dev->fold.page_buf, 1);
+        dev->fold.victim = -1;
+    }
+    dev->slc_next = 0;
+    dev->gc_debt = 0;
+    memset(dev->gc_victim, 0, sizeof(dev->gc_victim));
+    for (size_t i = 0; dev->dedup_index != NULL && i < DEDUP_INDEX_SIZE; i++)
+    {
+        dev->dedup_index[i].pca = INVALID_PCA;
+    }
+    dev->power_lost = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (ftl_mount(dev) != 0 || (dev->cfg.zns && zns_mount(dev) != 0))
+    {
+        printf("Remount after power loss failed\n");
+        return;
+    }
+    stream_mount(dev);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    page_buf = page_pool_get(dev, 1);
+    if (page_buf == NULL)
+    {
+        return;
+    }
+
+    // Compare every acknowledged LBA against what the device returns now
+    for (size_t lba = 0; lba < dev->total_lbas; lba++)
+    {
+        uint32_t crc = 0;
+
+        if (!dev->acked[lba])
+        {
+            continue;
+        }
+        // An unmapped LBA reads as zeros, which deduplication writes without a page
+        memset(page_buf, 0x00, 512);
+        if (dev->L2P[lba] == INVALID_PCA || ftl_read(dev, page_buf, lba) == 512)
+        {
+            crc = crc32c_update(0, page_buf, 512);
+        }
+        if (dev->acked[lba] == 1 && crc != dev->acked_crc[lba])
+        {
+            if (dev->L2P[lba] == INVALID_PCA)
+            {
+                lost++;
+            }
+            else
+            {
+                rolled_back++;
+            }
+        }
+        checked += dev->acked[lba] == 1;
+
+        // The recovered data is what later writes are compared against
+        dev->acked_crc[lba] = crc;
+        dev->acked[lba] = 1;
+    }
+    page_pool_put(dev, page_buf, 1);
+
+    printf("Power loss recovery: %.3f ms, %zu acknowledged LBAs checked, %zu lost, %zu rolled back\n",
+           (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6,
+           checked, lost, rolled_back);
+}
+
+// Actual implementation of reading data
+static int ssd_do_read(struct ssd_dev* dev, struct ssd_volume* vol, char* buf, size_t size, off_t offset)
+{
+    int tmp_lba, tmp_lba_range, idx, chunk, ret;
+    size_t process_size = 0;
+
+    // Check if the read range out of limit
+    if (offset < 0)
+    {
+        return -EINVAL;
+    }
+    if ((size_t)offset >= vol->logic_size)
+    {
+        return 0;
+    }
+    if (size > vol->logic_size - offset)
+    {
+        // Adjust read size
+        size = vol->logic_size - offset;
+    }
+
+    // Calculate the starting LBA
+    tmp_lba = vol->base + offset / 512;
+
+    // Calculate the number of LBAs to be read
+	tmp_lba_range = (offset + size - 1) / 512 - offset / 512 + 1;
+
+
+    char* page_buf = page_pool_get(dev, NAND_IO_CHUNK);
+    if (page_buf == NULL)
+    {
+        return -ENOMEM;
+    }
+
+    // Read the pages of the request in batches of up to NAND_IO_CHUNK
+    for (idx = 0; idx < tmp_lba_range; idx += chunk)
+    {
+        chunk = (tmp_lba_range - idx < NAND_IO_CHUNK) ? tmp_lba_range - idx : NAND_IO_CHUNK;
+        size_t page_offset = (offset + process_size) % 512;
+        size_t read_size = (size - process_size < chunk * 512 - page_offset) ? size - process_size : chunk * 512 - page_offset;
+
+        ret = ftl_read_pages(dev, page_buf, chunk, tmp_lba + idx);
+        if (ret < 0)
+        {
+            page_pool_put(dev, page_buf, NAND_IO_CHUNK);
+            return ret;
+        }
+
+        memcpy(buf + process_size, page_buf + page_offset, read_size);
+        process_size += read_size;
+    }
+    page_pool_put(dev, page_buf, NAND_IO_CHUNK);
+
+    return size;
+}
+
+// Record the outcome of a host write request for the power loss report
+static void powercut_track(struct ssd_dev* dev, uint32_t* staged_crc, size_t lba, size_t lba_range, int completed)
+{
+    if (staged_crc == NULL)
+    {
+        return;
+    }
+    for (size_t i = 0; i < lba_range; i++)
+    {
+        if (completed)
+        {
+            dev->acked_crc[lba + i] = staged_crc[i];
+            dev->acked[lba + i] = 1;
+        }
+        else
+        {
+            // A failed request may legally leave either the old or the new data
+            dev->acked[lba + i] = 2;
+        }
+    }
+    free(staged_crc);
+}
+
+// The data of a volume changed without a host write, the power loss report skips its LBAs until they are written
+static void powercut_forget(struct ssd_dev* dev, const struct ssd_volume* vol)
+{
+    if (dev->acked != NULL)
+    {
+        memset(dev->acked + vol->base, 0, vol->lbas);
+    }
+}
+
+// Actual write file
+static int ssd_do_write(struct ssd_dev* dev, struct ssd_volume* vol, const char* buf, size_t size, off_t offset)
+{
+    int tmp_lba, tmp_lba_range;
+    int idx, chunk, ret;
+    size_t process_size = 0;
+    uint32_t* staged_crc = NULL;
+
+    if (offset < 0)
+    {
+        return -EINVAL;
+    }
+
+    // Check and expand the logical size
+    if (ssd_expand(vol, offset + size) != 0)
+    {
+        return -ENOMEM;
+    }
+
+    // Update the total amount of data written by the host
+    dev->host_write_size += size;
+    journal_append(dev, JRNL_HOST_WRITE, vol - dev->vols, 0, size, vol->logic_size);
+
+    // Starting LBA
+    tmp_lba = vol->base + offset / 512;
+
+    // Number of LBAs to be written
+    tmp_lba_range = (offset + size - 1) / 512 - offset / 512 + 1;
+
+    // Remember what the host wrote, it is acknowledged only if the whole request succeeds
+    if (dev->acked_crc != NULL && (staged_crc = malloc(tmp_lba_range * sizeof(*staged_crc))) == NULL)
+    {
+        return -ENOMEM;
+    }
+
+    char* page_buf = page_pool_get(dev, NAND_IO_CHUNK);
+    if (page_buf == NULL)
+    {
+        powercut_track(dev, staged_crc, tmp_lba, tmp_lba_range, 0);
+        return -ENOMEM;
+    }
+
+    // Write the pages of the request in batches of up to NAND_IO_CHUNK
+    for (idx = 0; idx < tmp_lba_range; idx += chunk)
+    {
+        chunk = (tmp_lba_range - idx < NAND_IO_CHUNK) ? tmp_lba_range - idx : NAND_IO_CHUNK;
+        size_t page_offset = (offset + process_size) % 512;
+        size_t write_size = (size - process_size < chunk * 512 - page_offset) ? size - process_size : chunk * 512 - page_offset;
+
+        // Read the existing data of partially written first and last pages
+        ret = 0;
+        if (page_offset != 0)
+        {
+            ret = ftl_read_pages(dev, page_buf, 1, tmp_lba + idx);
+        }
+        if (ret == 0 && (page_offset + write_size) % 512 != 0 && (chunk > 1 || page_offset == 0))
+        {
+            ret = ftl_read_pages(dev, page_buf + (chunk - 1) * 512, 1, tmp_lba + idx + chunk - 1);
+        }
+        if (ret < 0)
+        {
+            page_pool_put(dev, page_buf, NAND_IO_CHUNK);
+            powercut_track(dev, staged_crc, tmp_lba, tmp_lba_range, 0);
+            return ret;
+        }
+
+        // Update the necessary portion
+        memcpy(page_buf + page_offset, buf + process_size, write_size);
+
+        ret = ftl_write(dev, page_buf, chunk, tmp_lba + idx);
+        if (ret < 0)
+        {
+            page_pool_put(dev, page_buf, NAND_IO_CHUNK);
+            powercut_track(dev, staged_crc, tmp_lba, tmp_lba_range, 0);
+            return ret;
+        }
+        if (staged_crc != NULL)
+        {
+            for (int i = 0; i < chunk; i++)
+            {
+                staged_crc[idx + i] = crc32c_update(0, page_buf + i * 512, 512);
+            }
+        }
+
+        process_size += write_size;
+    }
+    page_pool_put(dev, page_buf, NAND_IO_CHUNK);
+
+    powercut_track(dev, staged_crc, tmp_lba, tmp_lba_range, 1);
+
+    return size;
+}
+
+
+// Rebuild the zones from the block tables, a block belongs to the zone of the data it holds
+static int zns_mount(struct ssd_dev* dev)
+{
+    size_t zones_used = 0;
+
+    for (size_t zone = 0; zone < SSD_ZONE_NUM; zone++)
+    {
+        dev->zones[zone].block = -1;
+        dev->zones[zone].state = SSD_ZONE_EMPTY;
+        dev->zones[zone].wp = 0;
+    }
+
+    for (size_t block = 0; block < PHYSICAL_NAND_NUM; block++)
+    {
+        size_t zone = SSD_ZONE_NUM;
+        int zoned = 1;
+
+        for (size_t page = 0; page < PAGES_PER_BLOCK; page++)
+        {
+            size_t index = block * PAGES_PER_BLOCK + page;
+            size_t lba = dev->P2L[index];
+
+            if (dev->page_valid[index] != 1)
+            {
+                continue;
+            }
+            if (lba >= dev->total_lbas || lba % PAGES_PER_BLOCK != page ||
+                (zone != SSD_ZONE_NUM && zone != lba / PAGES_PER_BLOCK))
+            {
+                zoned = 0;
+                break;
+            }
+            zone = lba / PAGES_PER_BLOCK;
+        }
+
+        // A block without data belongs to no zone, it is erased when a zone takes it
+        if (zoned && zone == SSD_ZONE_NUM)
+        {
+            continue;
+        }
+        if (!zoned || dev->zones[zone].block >= 0)
+        {
+            printf("Block %zu is not laid out in zones, erase the NAND to use it zoned\n", block);
+            return -EINVAL;
+        }
+        dev->zones[zone].block = block;
+        dev->zones[zone].wp = zns_block_wp(dev, block);
+        dev->zones[zone].state = dev->zones[zone].wp == PAGES_PER_BLOCK ? SSD_ZONE_FULL : SSD_ZONE_CLOSED;
+        zones_used++;
+    }
+
+    ftl_printf(dev, "Zoned namespace: %d zones of %d pages, %zu in use\n", SSD_ZONE_NUM, PAGES_PER_BLOCK, zones_used);
+    return 0;
+}
+
+// Take the least worn block that holds no data for a zone, erasing it if it is not blank
+static int zns_alloc_block(struct ssd_dev* dev)
+{
+    int best = -1;
+
+    for (int block = 0; block < PHYSICAL_NAND_NUM; block++)
+    {
+        int taken = count_valid_pages(dev, block) != 0;
+        for (size_t zone = 0; zone < SSD_ZONE_NUM; zone++)
+        {
+            taken |= dev->zones[zone].block == block;
+        }
+        if (!taken && (best < 0 || dev->erase_counts[block] < dev->erase_counts[best]))
+        {
+            best = block;
+        }
+    }
+    if (best < 0)
+    {
+        printf("No block left for a zone\n");
+        return -ENOSPC;
+    }
+    if (zns_block_wp(dev, best) != 0 && nand_erase(dev, best) < 0)
+    {
+        return -EIO;
+    }
+    return best;
+}
+
+// Open a zone, it gets its block when it is opened from empty
+static int zns_zone_open(struct ssd_dev* dev, struct zns_zone* zone, int state)
+{
+    if (zone->block < 0)
+    {
+        int block = zns_alloc_block(dev);
+        if (block < 0)
+        {
+            return block;
+        }
+        zone->block = block;
+    }
+
+    // An explicitly opened zone stays open until the host closes it
+    if (zone->state != SSD_ZONE_EXPLICIT_OPEN)
+    {
+        zone->state = state;
+    }
+    return 0;
+}
+
+// Zoned write, it has to start at the write pointer of a zone and must not cross into the next zone
+static int zns_write(struct ssd_dev* dev, const char* buf, size_t size, off_t offset)
+{
+    struct zns_zone* zone;
+    int ret;
+
+    if (size == 0)
+    {
+        return 0;
+    }
+    if (offset < 0 || offset % 512 != 0 || size % 512 != 0 || offset / SSD_ZONE_SIZE >= SSD_ZONE_NUM ||
+        (offset + size - 1) / SSD_ZONE_SIZE != (size_t)offset / SSD_ZONE_SIZE)
+    {
+        return -EINVAL;
+    }
+
+    zone = &dev->zones[offset / SSD_ZONE_SIZE];
+    if (zone->state == SSD_ZONE_FULL)
+    {
+        return -ENOSPC;
+    }
+    if ((size_t)offset % SSD_ZONE_SIZE != zone->wp * 512)
+    {
+        ftl_printf(dev, "Write at %lld is not at the write pointer of zone %lld\n",
+                   (long long)offset, (long long)(offset / SSD_ZONE_SIZE));
+        return -EINVAL;
+    }
+    if ((ret = zns_zone_open(dev, zone, SSD_ZONE_IMPLICIT_OPEN)) < 0)
+    {
+        return ret;
+    }
+
+    ret = ssd_do_write(dev, &dev->vols[0], buf, size, offset);
+
+    // A page that failed to program still takes its place in the zone
+    zone->wp = zns_block_wp(dev, zone->block);
+    if (zone->wp == PAGES_PER_BLOCK)
+    {
+        zone->state = SSD_ZONE_FULL;
+    }
+    return ret;
+}
+
+// Apply a zone management command
+static int zns_zone_mgmt(struct ssd_dev* dev, unsigned int cmd, struct zns_zone* zone)
+{
+    switch (cmd)
+    {
+        case SSD_ZONE_OPEN:
+            if (zone->state == SSD_ZONE_FULL)
+            {
+                return -EINVAL;
+            }
+            return zns_zone_open(dev, zone, SSD_ZONE_EXPLICIT_OPEN);
+        case SSD_ZONE_CLOSE:
+            if (zone->state == SSD_ZONE_CLOSED)
+            {
+                return 0;
+            }
+            if (zone->state != SSD_ZONE_IMPLICIT_OPEN && zone->state != SSD_ZONE_EXPLICIT_OPEN)
+            {
+                return -EINVAL;
+            }
+            // A zone closed before its first write goes back to empty and gives its blank block back
+            if (zone->wp == 0)
+            {
+                zone->block = -1;
+                zone->state = SSD_ZONE_EMPTY;
+            }
+            else
+            {
+                zone->state = SSD_ZONE_CLOSED;
+            }
+            return 0;
+        case SSD_ZONE_FINISH:
+            if (zone->state == SSD_ZONE_FULL)
+            {
+                return 0;
+            }
+            // The rest of the block is given up, the checkpoint keeps the zone full across a remount.
+            // An empty zone has no block to record it in and comes back empty.
+            if (zone->block >= 0)
+            {
+                for (size_t page = zone->wp; page < PAGES_PER_BLOCK; page++)
+                {
+                    dev->page_valid[zone->block * PAGES_PER_BLOCK + page] = -1;
+                }
+            }
+            zone->wp = PAGES_PER_BLOCK;
+            zone->state = SSD_ZONE_FULL;
+            return zone->block >= 0 ? ckpt_write(dev) : 0;
+        case SSD_ZONE_RESET:
+            // Unmap the zone and checkpoint that before the erase, a reset cut by power loss then leaves
+            // the zone empty instead of half erased
+            if (zone->block >= 0)
+            {
+                for (size_t page = 0; page < PAGES_PER_BLOCK; page++)
+                {
+                    size_t index = zone->block * PAGES_PER_BLOCK + page;
+                    if (dev->page_valid[index] == 1)
+                    {
+                        ftl_unmap_tables(dev, dev->P2L[index]);
+                    }
+                }
+                if (ckpt_write(dev) != 0 || nand_erase(dev, zone->block) < 0)
+                {
+                    return -EIO;
+                }
+            }
+            zone->block = -1;
+            zone->state = SSD_ZONE_EMPTY;
+            zone->wp = 0;
+            return 0;
+    }
+    return -EINVAL;
+}
+
+// Background thread folding the SLC cache while host writes are idle. It holds wlock while it folds,
+// a page at a time, and steps aside as soon as a host write waits for it.
+static void* fold_worker(void* arg)
+{
+    struct ssd_dev* dev = arg;
+    struct timespec deadline;
+    int more = 1;
+
+    pthread_mutex_lock(&dev->wlock);
+    while (!__atomic_load_n(&dev->fold_stop, __ATOMIC_ACQUIRE))
+    {
+        if (!more || __atomic_load_n(&dev->writes_waiting, __ATOMIC_ACQUIRE) > 0 ||
+            now_ns(CLOCK_MONOTONIC) - dev->last_write < dev->cfg.slc_idle_ms * 1000000ULL)
+        {
+            // Waiting releases wlock, writers go first
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += (dev->cfg.slc_idle_ms ? dev->cfg.slc_idle_ms : 1) * 1000000L;
+            deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+            deadline.tv_nsec %= 1000000000L;
+            pthread_cond_timedwait(&dev->fold_wake, &dev->wlock, &deadline);
+            more = 1;
+            continue;
+        }
+
+        pthread_mutex_lock(&dev->lock);
+        more = ftl_fold_step(dev) > 0;
+        if (dev->power_lost)
+        {
+            powercut_recover(dev);
+        }
+        ftl_maybe_checkpoint(dev);
+        pthread_mutex_unlock(&dev->lock);
+    }
+    pthread_mutex_unlock(&dev->wlock);
+    return NULL;
+}
+
+// Fill a configuration with the defaults
+void ssd_config_init(struct ssd_config* cfg)
+{
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->nand_dir = NAND_LOCATION;
+    cfg->verbose = 1;
+    cfg->gc_pace = 1;
+    cfg->ecc_rber = ECC_DEFAULT_RBER;
+    cfg->qd = NAND_DEFAULT_QD;
+    cfg->slc_idle_ms = SLC_DEFAULT_IDLE_MS;
+    cfg->volumes = 1;
+}
+
+// Release everything a device holds, without checkpointing it
+static void ssd_dev_free(struct ssd_dev* dev)
+{
+    if (dev->journal_fp != NULL)
+    {
+        fclose(dev->journal_fp);
+        dev->journal_fp = NULL;
+    }
+    nand_close(dev);
+    nand_ring_exit(dev);
+    free(dev->L2P);
+    free(dev->P2L);
+    free(dev->page_valid);
+    free(dev->L2P_slice);
+    free(dev->page_refs);
+    free(dev->ref_head);
+    free(dev->ref_next);
+    free(dev->ref_prev);
+    free(dev->snap_L2P);
+    free(dev->snap_slice);
+    free(dev->dedup_index);
+    free(dev->acked_crc);
+    free(dev->acked);
+    free(dev->pool_base);
+    free(dev->pool_used);
+    pthread_mutex_destroy(&dev->lock);
+    pthread_mutex_destroy(&dev->wlock);
+    pthread_cond_destroy(&dev->reads_drained);
+    pthread_cond_destroy(&dev->fold_wake);
+    free(dev);
+}
+
+// Arm the power cut injection of a device
+static int powercut_arm(struct ssd_dev* dev)
+{
+    const char* kind = dev->cfg.powercut_kind;
+
+    if (kind == NULL || strcmp(kind, "any") == 0)
+        dev->powercut_kind = POWERCUT_ANY;
+    else if (strcmp(kind, "program") == 0)
+        dev->powercut_kind = POWERCUT_PROGRAM;
+    else if (strcmp(kind, "erase") == 0)
+        dev->powercut_kind = POWERCUT_ERASE;
+    else if (strcmp(kind, "gc") == 0)
+        dev->powercut_kind = POWERCUT_GC;
+    else
+    {
+        printf("Unknown powercut_kind %s\n", kind);
+        return -EINVAL;
+    }
+
+    if (dev->cfg.powercut != 0)
+    {
+        dev->powercut_countdown = dev->cfg.powercut;
+    }
+    else
+    {
+        srand(dev->cfg.powercut_seed ? dev->cfg.powercut_seed : time(NULL));
+        dev->powercut_countdown = 1 + rand() % dev->cfg.powercut_rand;
+    }
+
+    dev->acked_crc = calloc(dev->total_lbas, sizeof(*dev->acked_crc));
+    dev->acked = calloc(dev->total_lbas, sizeof(*dev->acked));
+    if (dev->acked_crc == NULL || dev->acked == NULL)
+    {
+        printf("Failed to allocate memory for power cut tracking.\n");
+        return -ENOMEM;
+    }
+    ftl_printf(dev, "Power cut armed after %zu operations\n", dev->powercut_countdown);
+    return 0;
+}
+
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+// Open a device, restoring the state its NAND was left in
+struct ssd_dev* ssd_dev_open(const struct ssd_config* cfg)
+{
+    size_t total_pages = PHYSICAL_NAND_NUM * PAGES_PER_BLOCK;
+    struct ssd_dev* dev;
+    int ret;
+
+    // The CRC tables are shared by every device of the process
+    pthread_once(&crc32c_once, crc32c_init);
+
+    dev = calloc(1, sizeof(*dev));
+    if (dev == NULL)
+    {
+        return NULL;
+    }
+    dev->cfg = *cfg;
+    ftl_printf(dev, "CRC32C using %s implementation\n", crc32c_impl == crc32c_sw ? "table" : "SSE4.2");
+    pthread_mutex_init(&dev->lock, NULL);
+    pthread_mutex_init(&dev->wlock, NULL);
+    pthread_cond_init(&dev->reads_drained, NULL);
+    pthread_cond_init(&dev->fold_wake, NULL);
+    dev->ring.fd = -1;
+    dev->ecc_rng = cfg->ecc_seed ? cfg->ecc_seed : (uint64_t)time(NULL) | 1;
+
+    // Fall back to blocking I/O if the kernel has no io_uring, a NAND in memory never needs it
+    if (dev->cfg.uring && dev->cfg.nand_dir != NULL)
+    {
+        if (dev->cfg.qd == 0)
+        {
+            dev->cfg.qd = NAND_DEFAULT_QD;
+        }
+        ret = nand_ring_init(dev, dev->cfg.qd);
+        if (ret < 0)
+        {
+            printf("io_uring setup failed (%d), using synchronous NAND I/O\n", ret);
+        }
+        else
+        {
+            ftl_printf(dev, "io_uring NAND backend, queue depth %u\n", dev->cfg.qd);
+        }
+    }
+
+    // Zones map every LBA to a fixed page, there is no room for packing
+    if (dev->cfg.compress && dev->cfg.zns)
+    {
+        printf("Compression is not available with zns, disabled\n");
+        dev->cfg.compress = 0;
+    }
+    if (dev->cfg.dedup && dev->cfg.zns)
+    {
+        printf("Deduplication is not available with zns, disabled\n");
+        dev->cfg.dedup = 0;
+    }
+
+    // Zones own whole blocks, and without the cache every LBA still needs a page with a block to spare for GC
+    if (dev->cfg.slc_blocks && dev->cfg.zns)
+    {
+        printf("SLC cache is not available with zns, disabled\n");
+        dev->cfg.slc_blocks = 0;
+    }
+    if (dev->cfg.slc_blocks > PHYSICAL_NAND_NUM - LOGICAL_NAND_NUM - 1)
+    {
+        printf("SLC cache limited to %d blocks, one spare block is left for GC\n", PHYSICAL_NAND_NUM - LOGICAL_NAND_NUM - 1);
+        dev->cfg.slc_blocks = PHYSICAL_NAND_NUM - LOGICAL_NAND_NUM - 1;
+    }
+
+    // Zones map LBAs to blocks themselves, a zoned device is a single volume
+    if (dev->cfg.volumes > 1 && dev->cfg.zns)
+    {
+        printf("Volumes are not available with zns, using one\n");
+        dev->cfg.volumes = 1;
+    }
+    if (dev->cfg.volumes > SSD_VOLUME_MAX)
+    {
+        printf("Volumes limited to %d\n", SSD_VOLUME_MAX);
+        dev->cfg.volumes = SSD_VOLUME_MAX;
+    }
+    if (dev->cfg.volumes == 0)
+    {
+        dev->cfg.volumes = 1;
+    }
+
+    // Room for the batch of a writer and of a read let in while it steps aside,
+    // the page of a GC nested in another and the OOB sectors of the pages in flight.
+    // With compression also the packed pages of a writer and the packed pages a read goes through,
+    // with deduplication the page a writer compares its data with and the LBA decompressed from it.
+    if (page_pool_init(dev, 2 * NAND_IO_CHUNK + 2 + (dev->ring.fd >= 0 ? dev->ring.entries / 2 : 1) +
+                       (dev->cfg.compress ? NAND_IO_CHUNK / 2 + NAND_IO_CHUNK + 1 : 0) +
+                       (dev->cfg.dedup ? 2 : 0)) != 0)
+    {
+        printf("Failed to allocate the page buffer pool.\n");
+        ssd_dev_free(dev);
+        return NULL;
+    }
+
+    dev->curr_pca.pca = INVALID_PCA;
+    dev->gc_paced.victim = -1;
+    dev->fold.victim = -1;
+
+    // Calculate the total number of LBAs
+    dev->total_lbas = LOGICAL_NAND_NUM * NAND_SIZE_KB * 1024 / 512;
+
+    dev->L2P = malloc(dev->total_lbas * sizeof(*dev->L2P));
+    dev->P2L = malloc(total_pages * sizeof(*dev->P2L));
+    dev->page_valid = calloc(total_pages, sizeof(*dev->page_valid));
+    dev->L2P_slice = calloc(dev->total_lbas, sizeof(*dev->L2P_slice));
+    dev->page_refs = calloc(total_pages, sizeof(*dev->page_refs));
+    if (dev->L2P == NULL || dev->P2L == NULL || dev->page_valid == NULL || dev->L2P_slice == NULL || dev->page_refs == NULL)
+    {
+        printf("Failed to allocate memory for the mapping tables.\n");
+        ssd_dev_free(dev);
+        return NULL;
+    }
+    for (size_t i = 0; i < dev->total_lbas; i++)
+    {
+        dev->L2P[i] = INVALID_PCA;
+    }
+    for (size_t i = 0; i < total_pages; i++)
+    {
+        dev->P2L[i] = INVALID_LBA;
+    }
+
+    // Every volume gets an equal slice of the LBAs
+    for (size_t vol = 0; vol < dev->cfg.volumes; vol++)
+    {
+        dev->vols[vol].lbas = dev->total_lbas / dev->cfg.volumes;
+        dev->vols[vol].base = vol * dev->vols[vol].lbas;
+        dev->vols[vol].stream.pca = INVALID_PCA;
+    }
+
+    // Snapshot slots, each one covers a volume
+    dev->snap_L2P = malloc(SSD_SNAPSHOT_MAX * dev->vols[0].lbas * sizeof(*dev->snap_L2P));
+    dev->snap_slice = malloc(SSD_SNAPSHOT_MAX * dev->vols[0].lbas * sizeof(*dev->snap_slice));
+    if (dev->snap_L2P == NULL || dev->snap_slice == NULL)
+    {
+        printf("Failed to allocate memory for the snapshot tables.\n");
+        ssd_dev_free(dev);
+        return NULL;
+    }
+    for (size_t snap = 0; snap < SSD_SNAPSHOT_MAX; snap++)
+    {
+        dev->snaps[snap].L2P = dev->snap_L2P + snap * dev->vols[0].lbas;
+        dev->snaps[snap].L2P_slice = dev->snap_slice + snap * dev->vols[0].lbas;
+    }
+    snap_reset(dev);
+
+    // Reference lists of the pages, with a node for every LBA and every snapshot entry
+    dev->ref_head = malloc(total_pages * sizeof(*dev->ref_head));
+    dev->ref_next = malloc((dev->total_lbas + SSD_SNAPSHOT_MAX * dev->vols[0].lbas) * sizeof(*dev->ref_next));
+    dev->ref_prev = malloc((dev->total_lbas + SSD_SNAPSHOT_MAX * dev->vols[0].lbas) * sizeof(*dev->ref_prev));
+    if (dev->ref_head == NULL || dev->ref_next == NULL || dev->ref_prev == NULL)
+    {
+        printf("Failed to allocate memory for the page reference lists.\n");
+        ssd_dev_free(dev);
+        return NULL;
+    }
+    for (size_t i = 0; i < total_pages; i++)
+    {
+        dev->ref_head[i] = REF_NONE;
+    }
+    if (dev->cfg.dedup)
+    {
+        dev->dedup_index = malloc(DEDUP_INDEX_SIZE * sizeof(*dev->dedup_index));
+        if (dev->dedup_index == NULL)
+        {
+            printf("Failed to allocate memory for the dedup index.\n");
+            ssd_dev_free(dev);
+            return NULL;
+        }
+        for (size_t i = 0; i < DEDUP_INDEX_SIZE; i++)
+        {
+            dev->dedup_index[i].pca = INVALID_PCA;
+        }
+    }
+
+    // Restore the previous state of the NAND
+    if (ftl_mount(dev) != 0 || (dev->cfg.zns && zns_mount(dev) != 0))
+    {
+        printf("Failed to mount NAND\n");
+        ssd_dev_free(dev);
+        return NULL;
+    }
+    stream_mount(dev);
+    if (dev->cfg.volumes > 1)
+    {
+        ftl_printf(dev, "%u volumes of %zu bytes\n", dev->cfg.volumes, dev->vols[0].lbas * 512);
+    }
+
+    if ((dev->cfg.powercut != 0 || dev->cfg.powercut_rand != 0) && powercut_arm(dev) != 0)
+    {
+        ssd_dev_free(dev);
+        return NULL;
+    }
+
+    dev->last_write = now_ns(CLOCK_MONOTONIC);
+    if (dev->cfg.slc_blocks)
+    {
+        ftl_printf(dev, "SLC cache of %u blocks, %d pages, folded after %u ms idle, spare blocks left for GC: %u\n",
+                   dev->cfg.slc_blocks, dev->cfg.slc_blocks * SLC_PAGES_PER_BLOCK,
+                   dev->cfg.slc_idle_ms, PHYSICAL_NAND_NUM - LOGICAL_NAND_NUM - dev->cfg.slc_blocks);
+    }
+    return dev;
+}
+
+// Start the fold thread. Without it the SLC cache only takes writes again once the host overwrites its data.
+int ssd_dev_start(struct ssd_dev* dev)
+{
+    int ret;
+
+    if (!dev->cfg.slc_blocks || dev->fold_started)
+    {
+        return 0;
+    }
+    ret = pthread_create(&dev->fold_thread, NULL, fold_worker, dev);
+    if (ret != 0)
+    {
+        printf("Failed to start the SLC fold thread (%d), the cache is not folded\n", -ret);
+        return -ret;
+    }
+    dev->fold_started = 1;
+    return 0;
+}
+
+// Flush the FTL state and release the device
+void ssd_dev_close(struct ssd_dev* dev)
+{
+    if (dev->fold_started)
+    {
+        __atomic_store_n(&dev->fold_stop, 1, __ATOMIC_RELEASE);
+        pthread_mutex_lock(&dev->wlock);
+        pthread_cond_signal(&dev->fold_wake);
+        pthread_mutex_unlock(&dev->wlock);
+        pthread_join(dev->fold_thread, NULL);
+    }
+
+    pthread_mutex_lock(&dev->wlock);
+    pthread_mutex_lock(&dev->lock);
+    if (dev->cfg.ecc)
+    {
+        printf("ECC: %zu reads, %zu corrected bits, %zu read retries, %zu uncorrectable, %.3f ms NAND busy\n",
+               dev->ecc_reads, dev->ecc_corrected_bits, dev->ecc_retries, dev->ecc_uncorrectable,
+               dev->nand_busy_ns / 1e6);
+    }
+    ckpt_write(dev);
+    pthread_mutex_unlock(&dev->lock);
+    pthread_mutex_unlock(&dev->wlock);
+    ssd_dev_free(dev);
+}
+
+unsigned int ssd_dev_volumes(struct ssd_dev* dev)
+{
+    return dev->cfg.volumes;
+}
+
+int ssd_dev_read(struct ssd_dev* dev, unsigned int vol, char* buf, size_t size, off_t offset)
+{
+    uint64_t start = now_ns(CLOCK_MONOTONIC);
+
+    if (vol >= dev->cfg.volumes)
+    {
+        return -EINVAL;
+    }
+
+    // Announce the read, so a writer in GC or in a program or erase steps aside for it
+    __atomic_add_fetch(&dev->reads_waiting, 1, __ATOMIC_RELEASE);
+    pthread_mutex_lock(&dev->lock);
+    __atomic_sub_fetch(&dev->reads_waiting, 1, __ATOMIC_RELEASE);
+
+    int ret = ssd_do_read(dev, &dev->vols[vol], buf, size, offset);
+    if (__atomic_load_n(&dev->reads_waiting, __ATOMIC_ACQUIRE) == 0)
+    {
+        pthread_cond_broadcast(&dev->reads_drained);
+    }
+    pthread_mutex_unlock(&dev->lock);
+
+    if (ret >= 0)
+    {
+        stats_add(dev, host_read_ops, 1);
+        stats_add(dev, host_read_bytes, ret);
+        stats_add(dev, vol[vol].host_read_ops, 1);
+        stats_add(dev, vol[vol].host_read_bytes, ret);
+    }
+    uint64_t ns = now_ns(CLOCK_MONOTONIC) - start;
+    stats_lat_add(dev, SSD_LAT_HOST_READ, ns);
+    stats_hist_add(&dev->stats.vol[vol].read_lat, ns);
+    return ret;
+}
+
+int ssd_dev_write(struct ssd_dev* dev, unsigned int vol, const char* buf, size_t size, off_t offset)
+{
+    uint64_t start = now_ns(CLOCK_MONOTONIC);
+
+    if (vol >= dev->cfg.volumes)
+    {
+        return -EINVAL;
+    }
+
+    // Announce the write, so folding of the SLC cache steps aside for it
+    __atomic_add_fetch(&dev->writes_waiting, 1, __ATOMIC_RELEASE);
+    pthread_mutex_lock(&dev->wlock);
+    __atomic_sub_fetch(&dev->writes_waiting, 1, __ATOMIC_RELEASE);
+    pthread_mutex_lock(&dev->lock);
+    int ret = dev->cfg.zns ? zns_write(dev, buf, size, offset) : ssd_do_write(dev, &dev->vols[vol], buf, size, offset);
+    if (dev->power_lost)
+    {
+        powercut_recover(dev);
+    }
+    ftl_maybe_checkpoint(dev);
+    dev->last_write = now_ns(CLOCK_MONOTONIC);
+    pthread_mutex_unlock(&dev->lock);
+    pthread_mutex_unlock(&dev->wlock);
+
+    if (ret >= 0)
+    {
+        stats_add(dev, host_write_ops, 1);
+        stats_add(dev, host_write_bytes, ret);
+        stats_add(dev, vol[vol].host_write_ops, 1);
+        stats_add(dev, vol[vol].host_write_bytes, ret);
+    }
+    uint64_t ns = now_ns(CLOCK_MONOTONIC) - start;
+    stats_lat_add(dev, SSD_LAT_HOST_WRITE, ns);
+    stats_hist_add(&dev->stats.vol[vol].write_lat, ns);
+    return ret;
+}
+
+int ssd_dev_truncate(struct ssd_dev* dev, unsigned int vol, off_t size)
+{
+    if (vol >= dev->cfg.volumes)
+    {
+        return -EINVAL;
+    }
+
+    __atomic_add_fetch(&dev->writes_waiting, 1, __ATOMIC_RELEASE);
+    pthread_mutex_lock(&dev->wlock);
+    __atomic_sub_fetch(&dev->writes_waiting, 1, __ATOMIC_RELEASE);
+    pthread_mutex_lock(&dev->lock);
+    int ret = ssd_resize(&dev->vols[vol], size);
+    if (ret == 0)
+    {
+        journal_append(dev, JRNL_RESIZE, vol, 0, 0, dev->vols[vol].logic_size);
+        ftl_maybe_checkpoint(dev);
+    }
+    pthread_mutex_unlock(&dev->lock);
+    pthread_mutex_unlock(&dev->wlock);
+    return ret;
+}
+
+void ssd_dev_get_counters(struct ssd_dev* dev, unsigned int vol, struct ssd_dev_counters* counters)
+{
+    pthread_mutex_lock(&dev->lock);
+    counters->logic_size = vol < dev->cfg.volumes ? dev->vols[vol].logic_size : 0;
+    counters->physic_size = dev->physic_size;
+    counters->host_write_size = dev->host_write_size;
+    counters->nand_write_size = dev->nand_write_size;
+    counters->gc_count = dev->gc_count;
+    pthread_mutex_unlock(&dev->lock);
+}
+
+#define stats_load(dev, field) __atomic_load_n(&(dev)->stats.field, __ATOMIC_RELAXED)
+
+static void stats_hist_load(struct ssd_lat_hist* dst, const struct ssd_lat_hist* src)
+{
+    for (int bucket = 0; bucket < SSD_STATS_HIST_BUCKETS; bucket++)
+    {
+        dst->count[bucket] = __atomic_load_n(&src->count[bucket], __ATOMIC_RELAXED);
+    }
+    dst->total = __atomic_load_n(&src->total, __ATOMIC_RELAXED);
+    dst->sum_ns = __atomic_load_n(&src->sum_ns, __ATOMIC_RELAXED);
+    dst->max_ns = __atomic_load_n(&src->max_ns, __ATOMIC_RELAXED);
+}
+
+void ssd_dev_get_stats(struct ssd_dev* dev, struct ssd_stats* stats)
+{
+    uint64_t erase_sum = 0;
+
+    memset(stats, 0, sizeof(*stats));
+    stats->host_read_ops = stats_load(dev, host_read_ops);
+    stats->host_read_bytes = stats_load(dev, host_read_bytes);
+    stats->host_write_ops = stats_load(dev, host_write_ops);
+    stats->host_write_bytes = stats_load(dev, host_write_bytes);
+    stats->nand_read_ops = stats_load(dev, nand_read_ops);
+    stats->nand_read_bytes = stats_load(dev, nand_read_bytes);
+    stats->nand_write_ops = stats_load(dev, nand_write_ops);
+    stats->nand_write_bytes = stats_load(dev, nand_write_bytes);
+    stats->gc_count = stats_load(dev, gc_count);
+    stats->gc_pages_relocated = stats_load(dev, gc_pages_relocated);
+    stats->erase_total = stats_load(dev, erase_total);
+    stats->gc_preemptions = stats_load(dev, gc_preemptions);
+    stats->nand_suspends = stats_load(dev, nand_suspends);
+    stats->packed_pages = stats_load(dev, packed_pages);
+    stats->packed_lbas = stats_load(dev, packed_lbas);
+    stats->dedup_lbas = stats_load(dev, dedup_lbas);
+    stats->zero_lbas = stats_load(dev, zero_lbas);
+    stats->slc_host_pages = stats_load(dev, slc_host_pages);
+    stats->slc_bypass_pages = stats_load(dev, slc_bypass_pages);
+    stats->slc_folded_pages = stats_load(dev, slc_folded_pages);
+    stats->slc_folds = stats_load(dev, slc_folds);
+    for (int kind = 0; kind < SSD_LAT_NUM; kind++)
+    {
+        stats_hist_load(&stats->lat[kind], &dev->stats.lat[kind]);
+    }
+    stats->volumes = dev->cfg.volumes;
+    for (size_t vol = 0; vol < dev->cfg.volumes; vol++)
+    {
+        stats->vol[vol].host_read_ops = stats_load(dev, vol[vol].host_read_ops);
+        stats->vol[vol].host_read_bytes = stats_load(dev, vol[vol].host_read_bytes);
+        stats->vol[vol].host_write_ops = stats_load(dev, vol[vol].host_write_ops);
+        stats->vol[vol].host_write_bytes = stats_load(dev, vol[vol].host_write_bytes);
+        stats->vol[vol].nand_write_ops = stats_load(dev, vol[vol].nand_write_ops);
+        stats->vol[vol].gc_pages_relocated = stats_load(dev, vol[vol].gc_pages_relocated);
+        stats->vol[vol].shared_pages = stats_load(dev, vol[vol].shared_pages);
+        stats_hist_load(&stats->vol[vol].read_lat, &dev->stats.vol[vol].read_lat);
+        stats_hist_load(&stats->vol[vol].write_lat, &dev->stats.vol[vol].write_lat);
+    }
+
+    // Block state belongs to the FTL, it is only consistent under the lock
+    pthread_mutex_lock(&dev->lock);
+    stats->erase_min = UINT32_MAX;
+    for (size_t block = 0; block < PHYSICAL_NAND_NUM; block++)
+    {
+        size_t free_pages = 0;
+        for (size_t page = 0; page < PAGES_PER_BLOCK; page++)
+        {
+            free_pages += dev->page_valid[block * PAGES_PER_BLOCK + page] == 0;
+        }
+        stats->free_blocks += free_pages == PAGES_PER_BLOCK;
+
+        stats->erase_counts[block] = dev->erase_counts[block];
+        if (stats->erase_counts[block] < stats->erase_min)
+            stats->erase_min = stats->erase_counts[block];
+        if (stats->erase_counts[block] > stats->erase_max)
+            stats->erase_max = stats->erase_counts[block];
+        erase_sum += dev->erase_counts[block];
+    }
+
+    // Volumes holding valid data in every block, and the pages some LBA maps
+    unsigned int owners[PHYSICAL_NAND_NUM] = { 0 };
+    unsigned char mapped[PHYSICAL_NAND_NUM * PAGES_PER_BLOCK] = { 0 };
+    for (size_t lba = 0; lba < dev->total_lbas; lba++)
+    {
+        if (dev->L2P[lba] != INVALID_PCA)
+        {
+            stats->vol[ftl_lba_volume(dev, lba)].mapped_lbas++;
+            owners[dev->L2P[lba] >> 16] |= 1U << ftl_lba_volume(dev, lba);
+            mapped[(dev->L2P[lba] >> 16) * PAGES_PER_BLOCK + (dev->L2P[lba] & 0xFFFF)] = 1;
+        }
+    }
+    for (size_t block = 0; block < PHYSICAL_NAND_NUM; block++)
+    {
+        stats->mixed_blocks += __builtin_popcount(owners[block]) > 1;
+        for (size_t vol = 0; vol < dev->cfg.volumes; vol++)
+        {
+            stats->vol[vol].blocks += (owners[block] >> vol) & 1;
+        }
+    }
+    for (size_t vol = 0; vol < dev->cfg.volumes; vol++)
+    {
+        stats->vol[vol].logic_size = dev->vols[vol].logic_size;
+        stats->vol[vol].capacity = dev->vols[vol].lbas * 512;
+    }
+    for (size_t index = 0; index < PHYSICAL_NAND_NUM * PAGES_PER_BLOCK; index++)
+    {
+        stats->snapshot_pages += dev->page_valid[index] == 1 && !mapped[index];
+    }
+    for (size_t snap = 0; snap < SSD_SNAPSHOT_MAX; snap++)
+    {
+        if (dev->snaps[snap].vol == SNAP_FREE)
+        {
+            continue;
+        }
+        stats->snapshots++;
+        stats->snap[snap].used = 1;
+        stats->snap[snap].volume = dev->snaps[snap].vol;
+        stats->snap[snap].logic_size = dev->snaps[snap].logic_size;
+        for (size_t i = 0; i < dev->vols[0].lbas; i++)
+        {
+            stats->snap[snap].mapped_lbas += dev->snaps[snap].L2P[i] != INVALID_PCA;
+        }
+    }
+    pthread_mutex_unlock(&dev->lock);
+    stats->erase_mean = (double)erase_sum / PHYSICAL_NAND_NUM;
+}
+
+int ssd_dev_snapshot_create(struct ssd_dev* dev, unsigned int vol)
+{
+    int ret = -ENOSPC;
+
+    if (dev->cfg.zns)
+    {
+        return -EOPNOTSUPP;
+    }
+    if (vol >= dev->cfg.volumes)
+    {
+        return -EINVAL;
+    }
+
+    __atomic_add_fetch(&dev->writes_waiting, 1, __ATOMIC_RELEASE);
+    pthread_mutex_lock(&dev->wlock);
+    __atomic_sub_fetch(&dev->writes_waiting, 1, __ATOMIC_RELEASE);
+    pthread_mutex_lock(&dev->lock);
+    for (size_t snap = 0; snap < SSD_SNAPSHOT_MAX; snap++)
+    {
+        if (dev->snaps[snap].vol == SNAP_FREE)
+        {
+            snap_take(dev, &dev->snaps[snap], vol);
+            journal_append(dev, JRNL_SNAP_CREATE, snap, vol, 0, 0);
+            ftl_printf(dev, "Snapshot %zu taken of volume %u\n", snap, vol);
+            ret = snap;
+            break;
+        }
+    }
+    ftl_maybe_checkpoint(dev);
+    pthread_mutex_unlock(&dev->lock);
+    pthread_mutex_unlock(&dev->wlock);
+    return ret;
+}
+
+int ssd_dev_snapshot_delete(struct ssd_dev* dev, size_t snap)
+{
+    int ret = 0;
+
+    if (dev->cfg.zns)
+    {
+        return -EOPNOTSUPP;
+    }
+    if (snap >= SSD_SNAPSHOT_MAX)
+    {
+        return -EINVAL;
+    }
+
+    __atomic_add_fetch(&dev->writes_waiting, 1, __ATOMIC_RELEASE);
+    pthread_mutex_lock(&dev->wlock);
+    __atomic_sub_fetch(&dev->writes_waiting, 1, __ATOMIC_RELEASE);
+    pthread_mutex_lock(&dev->lock);
+    if (dev->snaps[snap].vol == SNAP_FREE)
+    {
+        ret = -ENOENT;
+    }
+    else
+    {
+        snap_drop(dev, &dev->snaps[snap]);
+        journal_append(dev, JRNL_SNAP_DELETE, snap, 0, 0, 0);
+        ftl_printf(dev, "Snapshot %zu deleted\n", snap);
+        ftl_maybe_checkpoint(dev);
+    }
+    pthread_mutex_unlock(&dev->lock);
+    pthread_mutex_unlock(&dev->wlock);
+    return ret;
+}
+
+int ssd_dev_snapshot_restore(struct ssd_dev* dev, unsigned int vol, size_t snap)
+{
+    int ret = 0;
+
+    if (dev->cfg.zns)
+    {
+        return -EOPNOTSUPP;
+    }
+    if (vol >= dev->cfg.volumes || snap >= SSD_SNAPSHOT_MAX)
+    {
+        return -EINVAL;
+    }
+
+    __atomic_add_fetch(&dev->writes_waiting, 1, __ATOMIC_RELEASE);
+    pthread_mutex_lock(&dev->wlock);
+    __atomic_sub_fetch(&dev->writes_waiting, 1, __ATOMIC_RELEASE);
+    pthread_mutex_lock(&dev->lock);
+    if (dev->snaps[snap].vol == SNAP_FREE)
+    {
+        ret = -ENOENT;
+    }
+    else
+    {
+        snap_restore(dev, &dev->vols[vol], &dev->snaps[snap]);
+        powercut_forget(dev, &dev->vols[vol]);
+        journal_append(dev, JRNL_SNAP_RESTORE, vol, snap, 0, 0);
+        ftl_printf(dev, "Snapshot %zu restored to volume %u\n", snap, vol);
+        ftl_maybe_checkpoint(dev);
+    }
+    pthread_mutex_unlock(&dev->lock);
+    pthread_mutex_unlock(&dev->wlock);
+    return ret;
+}
+
+int ssd_dev_clone(struct ssd_dev* dev, unsigned int vol, unsigned int src)
+{
+    if (dev->cfg.zns)
+    {
+        return -EOPNOTSUPP;
+    }
+    if (vol >= dev->cfg.volumes || src >= dev->cfg.volumes)
+    {
+        return -EINVAL;
+    }
+
+    __atomic_add_fetch(&dev->writes_waiting, 1, __ATOMIC_RELEASE);
+    pthread_mutex_lock(&dev->wlock);
+    __atomic_sub_fetch(&dev->writes_waiting, 1, __ATOMIC_RELEASE);
+    pthread_mutex_lock(&dev->lock);
+    ftl_clone(dev, &dev->vols[vol], &dev->vols[src]);
+    powercut_forget(dev, &dev->vols[vol]);
+    journal_append(dev, JRNL_CLONE, vol, src, 0, 0);
+    ftl_printf(dev, "Volume %u cloned into volume %u\n", src, vol);
+    ftl_maybe_checkpoint(dev);
+    pthread_mutex_unlock(&dev->lock);
+    pthread_mutex_unlock(&dev->wlock);
+    return 0;
+}
+
+int ssd_dev_zone_report(struct ssd_dev* dev, struct ssd_zone_report* report)
+{
+    if (!dev->cfg.zns)
+    {
+        return -EOPNOTSUPP;
+    }
+
+    memset(report, 0, sizeof(*report));
+    report->nr_zones = SSD_ZONE_NUM;
+    pthread_mutex_lock(&dev->lock);
+    for (size_t zone = 0; zone < SSD_ZONE_NUM; zone++)
+    {
+        report->zones[zone].start = zone * SSD_ZONE_SIZE;
+        report->zones[zone].len = SSD_ZONE_SIZE;
+        report->zones[zone].wp = zone * SSD_ZONE_SIZE + dev->zones[zone].wp * 512;
+        report->zones[zone].state = dev->zones[zone].state;
+        report->zones[zone].block = dev->zones[zone].block;
+    }
+    pthread_mutex_unlock(&dev->lock);
+    return 0;
+}
+
+int ssd_dev_zone_mgmt(struct ssd_dev* dev, unsigned int cmd, size_t zone)
+{
+    if (!dev->cfg.zns)
+    {
+        return -EOPNOTSUPP;
+    }
+    if (zone >= SSD_ZONE_NUM)
+    {
+        return -EINVAL;
+    }
+
+    pthread_mutex_lock(&dev->wlock);
+    pthread_mutex_lock(&dev->lock);
+    int ret = zns_zone_mgmt(dev, cmd, &dev->zones[zone]);
+    if (dev->power_lost)
+    {
+        powercut_recover(dev);
+    }
+    ftl_maybe_checkpoint(dev);
+    pthread_mutex_unlock(&dev->lock);
+    pthread_mutex_unlock(&dev->wlock);
+    return ret;
+}
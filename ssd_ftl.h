@@ -0,0 +1,93 @@
+/*
+  FTL and NAND simulation library
+  Shared by the FUSE device and the standalone simulator, every device
+  instance keeps its whole state in its own struct ssd_dev.
+  This program can be distributed under the terms of the GNU GPLv2.
+  See the file COPYING.
+*/
+#ifndef SSD_FTL_H
+#define SSD_FTL_H
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "ssd_fuse_header.h"
+
+// Device configuration, the fields are also the -o options of the FUSE device
+struct ssd_config
+{
+    char* nand_dir;             // Directory of the NAND files, checkpoint and journal, NULL keeps the NAND in memory
+    int verbose;                // Log every FTL operation
+    unsigned int powercut;      // Cut power at this NAND operation, 0 disables
+    unsigned int powercut_rand; // Cut power at a random operation in [1, powercut_rand]
+    unsigned int powercut_seed; // Seed of the random cut point
+    char* powercut_kind;        // Operations counted: any, program, erase or gc
+    int timing;                 // Wait for the simulated NAND latency of every operation
+    int ecc;                    // Inject raw bit errors on read and decode them
+    double ecc_rber;            // Raw bit error rate of a fresh block
+    unsigned int ecc_seed;      // Seed of the bit error generator
+    int uring;                  // Issue NAND operations through io_uring
+    unsigned int qd;            // Pages in flight on the io_uring
+    int direct;                 // Bypass the host page cache with O_DIRECT
+    int gc_pace;                // Spread GC over host writes instead of collecting a block at once
+    int zns;                    // Zoned namespace, writes are sequential within zones and the host resets them
+    int compress;               // Compress LBAs and pack those that compress well several to a page, when they are
+                                // written together or when GC relocates them
+    int dedup;                  // Map LBAs whose data is already on NAND to it instead of writing them again,
+                                // those mappings are in the metadata only and a device without it is not scanned
+    unsigned int slc_blocks;    // Blocks run as an SLC write cache, folded into the others while the host is idle.
+                                // They come out of the spare blocks GC works with, at most all of them but one
+    unsigned int slc_idle_ms;   // Time host writes have to be idle before folding starts
+    unsigned int volumes;       // Volumes sharing the NAND, each writes to blocks of its own, up to SSD_VOLUME_MAX
+};
+
+// Counters of a device, the logical size is that of one volume, the others are shared by all volumes
+struct ssd_dev_counters
+{
+    size_t logic_size;      // Bytes of the logical address space of the volume in use
+    size_t physic_size;     // Programmed pages not erased yet
+    size_t host_write_size; // Bytes written by the host
+    size_t nand_write_size; // Bytes programmed to NAND
+    size_t gc_count;        // Completed garbage collections since the device was opened
+};
+
+struct ssd_dev;
+
+// Fill a configuration with the defaults: NAND files in NAND_LOCATION, verbose, paced GC
+void ssd_config_init(struct ssd_config* cfg);
+
+// Open a device, restoring the state its NAND was left in, NULL on failure
+struct ssd_dev* ssd_dev_open(const struct ssd_config* cfg);
+
+// Start the background work of a device, the SLC fold thread. Threads do not survive a fork, so a process
+// that forks after opening calls it in the child that serves the requests. 0 or -errno
+int ssd_dev_start(struct ssd_dev* dev);
+
+// Checkpoint the FTL state and release the device
+void ssd_dev_close(struct ssd_dev* dev);
+
+// Number of volumes of the device, each addressed from offset 0
+unsigned int ssd_dev_volumes(struct ssd_dev* dev);
+
+// Host requests to a volume, they return the number of bytes transferred or -errno
+int ssd_dev_read(struct ssd_dev* dev, unsigned int vol, char* buf, size_t size, off_t offset);
+int ssd_dev_write(struct ssd_dev* dev, unsigned int vol, const char* buf, size_t size, off_t offset);
+int ssd_dev_truncate(struct ssd_dev* dev, unsigned int vol, off_t size);
+
+void ssd_dev_get_counters(struct ssd_dev* dev, unsigned int vol, struct ssd_dev_counters* counters);
+
+// Snapshot of the statistics, safe to call while requests are running
+void ssd_dev_get_stats(struct ssd_dev* dev, struct ssd_stats* stats);
+
+// Snapshots and clones copy the mapping of a volume and share its pages, they are not available with zns.
+// Create returns the snapshot number, restore rolls a volume back to a snapshot, or clones it if it was
+// taken of another volume, and clone copies the current mapping of volume src into volume vol. 0 or -errno.
+int ssd_dev_snapshot_create(struct ssd_dev* dev, unsigned int vol);
+int ssd_dev_snapshot_delete(struct ssd_dev* dev, size_t snap);
+int ssd_dev_snapshot_restore(struct ssd_dev* dev, unsigned int vol, size_t snap);
+int ssd_dev_clone(struct ssd_dev* dev, unsigned int vol, unsigned int src);
+
+// Zoned namespace only: report every zone, or apply SSD_ZONE_OPEN, CLOSE, FINISH or RESET to one, 0 or -errno
+int ssd_dev_zone_report(struct ssd_dev* dev, struct ssd_zone_report* report);
+int ssd_dev_zone_mgmt(struct ssd_dev* dev, unsigned int cmd, size_t zone);
+
+#endif
@@ -14,6 +14,10 @@
 #include <ctype.h>
 #include <errno.h>
 #include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <pthread.h>
 #include "ssd_fuse_header.h"
 #include <time.h>
 const char* usage =
@@ -25,17 +29,863 @@ const char* usage =
     "  r SIZE [OFF] : read SIZE bytes @ OFF (dfl 0) and output to stdout\n"
     "  w SIZE [OFF] : write SIZE bytes @ OFF (dfl 0) from random\n"
     "  W    : write amplification factor\n"
+    "  s    : dump device statistics and latency histograms as JSON\n"
+    "  z    : report the zones of a zoned SSD as JSON\n"
+    "  Z open|close|finish|reset ZONE : zone management on a zoned SSD\n"
+    "  S create|delete|restore [SNAP] : snapshot the volume of SSD_FILE and print its number,\n"
+    "                                   delete snapshot SNAP or roll the volume back to it\n"
+    "  C SRC : clone volume SRC into the volume of SSD_FILE\n"
+    "  b [NAME=VALUE ...] : run a benchmark workload, results are printed as JSON\n"
+    "\n"
+    "BENCHMARK OPTIONS\n"
+    "  pattern=seq|rand|zipf|hotcold  access pattern (dfl rand)\n"
+    "  bs=BYTES        request size (dfl 512)\n"
+    "  read=PCT        percentage of reads in the mix (dfl 0)\n"
+    "  threads=N       worker threads (dfl 1)\n"
+    "  qd=N            workers per thread, each one waits for its request to complete,\n"
+    "                  so threads * qd requests are in flight (dfl 1)\n"
+    "  ops=N           total requests (dfl 10000)\n"
+    "  time=SEC        stop after SEC seconds, 0 for no limit (dfl 0)\n"
+    "  size=BYTES      size of the region accessed (dfl logical SSD size)\n"
+    "  theta=F         zipf skew (dfl 0.99)\n"
+    "  hot=PCT         hotcold: percentage of the region that is hot (dfl 20)\n"
+    "  hotio=PCT       hotcold: percentage of requests going to the hot part (dfl 80)\n"
+    "  seed=N          random seed (dfl 1)\n"
+    "\n"
+    "  t TRACE [NAME=VALUE ...] : replay a block trace, - reads it from stdin,\n"
+    "                             one JSON line is printed per time window\n"
+    "\n"
+    "REPLAY OPTIONS\n"
+    "  format=auto|blkparse|msr  blkparse text output or MSR Cambridge/SNIA CSV (dfl auto)\n"
+    "  action=C        blkparse event replayed, e.g. Q or D (dfl Q)\n"
+    "  speed=F         1 keeps the original timing, 10 replays 10x faster,\n"
+    "                  0 issues requests back to back (dfl 1)\n"
+    "  window=SEC      length of a reporting window in trace time (dfl 1)\n"
+    "  size=BYTES      logical region offsets are mapped into (dfl logical SSD size)\n"
+    "  span=BYTES      scale offsets by size/span instead of wrapping them around size\n"
     "\n";
+
+enum
+{
+    PATTERN_SEQ,
+    PATTERN_RAND,
+    PATTERN_ZIPF,
+    PATTERN_HOTCOLD,
+};
+static const char* pattern_names[] = { "seq", "rand", "zipf", "hotcold" };
+
+// Latency histogram, every power of two of ns is split into HIST_SUB linear buckets
+#define HIST_SUB_BITS (4)
+#define HIST_SUB      (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS  (64 * HIST_SUB)
+
+struct hist
+{
+    uint64_t count[HIST_BUCKETS];
+    uint64_t total;
+    uint64_t sum_ns;
+    uint64_t max_ns;
+};
+
+struct bench_opts
+{
+    int pattern;
+    size_t bs;
+    unsigned int read_pct;
+    unsigned int threads;
+    unsigned int qd;
+    size_t ops;
+    double time_s;
+    size_t size;
+    double theta;
+    unsigned int hot_pct;
+    unsigned int hotio_pct;
+    unsigned int seed;
+};
+
+struct bench_worker
+{
+    pthread_t tid;
+    int fd;
+    uint64_t rng;
+    char* buf;
+    struct hist lat[2];   // 0 read, 1 write
+    size_t bytes[2];
+    size_t errors;
+};
+
+static struct bench_opts bench;
+static size_t bench_blocks;        // Number of bs sized blocks in the region
+static double* zipf_cdf;           // Cumulative zipf probability of every block rank
+static size_t bench_next_op;       // Shared request counter
+static size_t bench_seq_block;     // Shared cursor of the sequential pattern
+static uint64_t bench_deadline_ns; // 0 without a time limit
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// xorshift64* generator, one per worker
+static uint64_t bench_rand(uint64_t* state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+// Uniform double in [0, 1)
+static double bench_rand_unit(uint64_t* state)
+{
+    return (bench_rand(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static unsigned int hist_bucket(uint64_t ns)
+{
+    if (ns < HIST_SUB)
+    {
+        return ns;
+    }
+    unsigned int exp = 63 - __builtin_clzll(ns);
+    unsigned int sub = (ns >> (exp - HIST_SUB_BITS)) & (HIST_SUB - 1);
+    return (exp - HIST_SUB_BITS + 1) * HIST_SUB + sub;
+}
+
+// Smallest latency that falls into the bucket after this one
+static uint64_t hist_bucket_upper(unsigned int bucket)
+{
+    if (bucket < HIST_SUB)
+    {
+        return bucket + 1;
+    }
+    unsigned int exp = bucket / HIST_SUB + HIST_SUB_BITS - 1;
+    uint64_t sub = bucket % HIST_SUB;
+    return ((HIST_SUB + sub + 1) << (exp - HIST_SUB_BITS));
+}
+
+static void hist_add(struct hist* h, uint64_t ns)
+{
+    h->count[hist_bucket(ns)]++;
+    h->total++;
+    h->sum_ns += ns;
+    if (ns > h->max_ns)
+    {
+        h->max_ns = ns;
+    }
+}
+
+static void hist_merge(struct hist* dst, const struct hist* src)
+{
+    for (int i = 0; i < HIST_BUCKETS; i++)
+    {
+        dst->count[i] += src->count[i];
+    }
+    dst->total += src->total;
+    dst->sum_ns += src->sum_ns;
+    if (src->max_ns > dst->max_ns)
+    {
+        dst->max_ns = src->max_ns;
+    }
+}
+
+// Upper bound of the bucket holding the given percentile
+static uint64_t hist_percentile(const struct hist* h, double pct)
+{
+    uint64_t target = ceil(h->total * pct / 100.0);
+    uint64_t seen = 0;
+
+    if (h->total == 0)
+    {
+        return 0;
+    }
+    for (int i = 0; i < HIST_BUCKETS; i++)
+    {
+        seen += h->count[i];
+        if (seen >= target && seen > 0)
+        {
+            uint64_t upper = hist_bucket_upper(i);
+            return upper < h->max_ns ? upper : h->max_ns;
+        }
+    }
+    return h->max_ns;
+}
+
+// Block rank tables of the zipf pattern, rank 0 being the most popular block
+static int zipf_init()
+{
+    double sum = 0;
+
+    zipf_cdf = malloc(bench_blocks * sizeof(*zipf_cdf));
+    if (!zipf_cdf)
+    {
+        return -1;
+    }
+    for (size_t i = 0; i < bench_blocks; i++)
+    {
+        sum += 1.0 / pow(i + 1, bench.theta);
+        zipf_cdf[i] = sum;
+    }
+    for (size_t i = 0; i < bench_blocks; i++)
+    {
+        zipf_cdf[i] /= sum;
+    }
+    return 0;
+}
+
+static size_t zipf_next(uint64_t* rng)
+{
+    double u = bench_rand_unit(rng);
+    size_t lo = 0, hi = bench_blocks - 1;
+
+    while (lo < hi)
+    {
+        size_t mid = (lo + hi) / 2;
+        if (zipf_cdf[mid] < u)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// Pick the block of the next request
+static size_t bench_next_block(struct bench_worker* w)
+{
+    size_t hot_blocks;
+
+    switch (bench.pattern)
+    {
+        case PATTERN_SEQ:
+            return __atomic_fetch_add(&bench_seq_block, 1, __ATOMIC_RELAXED) % bench_blocks;
+        case PATTERN_ZIPF:
+            return zipf_next(&w->rng);
+        case PATTERN_HOTCOLD:
+            hot_blocks = bench_blocks * bench.hot_pct / 100;
+            if (hot_blocks == 0)
+            {
+                hot_blocks = 1;
+            }
+            if (hot_blocks >= bench_blocks || bench_rand(&w->rng) % 100 < bench.hotio_pct)
+            {
+                return bench_rand(&w->rng) % hot_blocks;
+            }
+            return hot_blocks + bench_rand(&w->rng) % (bench_blocks - hot_blocks);
+        default:
+            return bench_rand(&w->rng) % bench_blocks;
+    }
+}
+
+static void* bench_run(void* arg)
+{
+    struct bench_worker* w = arg;
+
+    while (__atomic_fetch_add(&bench_next_op, 1, __ATOMIC_RELAXED) < bench.ops)
+    {
+        off_t offset = (off_t)bench_next_block(w) * bench.bs;
+        int is_read = bench_rand(&w->rng) % 100 < bench.read_pct;
+        uint64_t start, end;
+        ssize_t ret;
+
+        if (bench_deadline_ns && now_ns() >= bench_deadline_ns)
+        {
+            break;
+        }
+
+        start = now_ns();
+        if (is_read)
+        {
+            ret = pread(w->fd, w->buf, bench.bs, offset);
+        }
+        else
+        {
+            ret = pwrite(w->fd, w->buf, bench.bs, offset);
+        }
+        end = now_ns();
+
+        if (ret < 0 || (!is_read && (size_t)ret != bench.bs))
+        {
+            w->errors++;
+            continue;
+        }
+        hist_add(&w->lat[!is_read], end - start);
+        w->bytes[!is_read] += ret;
+    }
+    return NULL;
+}
+
+static int bench_parse(int argc, char** argv)
+{
+    bench.pattern = PATTERN_RAND;
+    bench.bs = 512;
+    bench.read_pct = 0;
+    bench.threads = 1;
+    bench.qd = 1;
+    bench.ops = 10000;
+    bench.time_s = 0;
+    bench.size = LOGICAL_NAND_NUM * NAND_SIZE_KB * 1024;
+    bench.theta = 0.99;
+    bench.hot_pct = 20;
+    bench.hotio_pct = 80;
+    bench.seed = 1;
+
+    for (int i = 0; i < argc; i++)
+    {
+        char* value = strchr(argv[i], '=');
+        if (!value)
+        {
+            return -1;
+        }
+        *value++ = '\0';
+
+        if (!strcmp(argv[i], "pattern"))
+        {
+            size_t p;
+            for (p = 0; p < sizeof(pattern_names) / sizeof(pattern_names[0]); p++)
+            {
+                if (!strcmp(value, pattern_names[p]))
+                {
+                    break;
+                }
+            }
+            if (p == sizeof(pattern_names) / sizeof(pattern_names[0]))
+            {
+                return -1;
+            }
+            bench.pattern = p;
+        }
+        else if (!strcmp(argv[i], "bs"))
+            bench.bs = strtoul(value, NULL, 0);
+        else if (!strcmp(argv[i], "read"))
+            bench.read_pct = strtoul(value, NULL, 0);
+        else if (!strcmp(argv[i], "threads"))
+            bench.threads = strtoul(value, NULL, 0);
+        else if (!strcmp(argv[i], "qd"))
+            bench.qd = strtoul(value, NULL, 0);
+        else if (!strcmp(argv[i], "ops"))
+            bench.ops = strtoul(value, NULL, 0);
+        else if (!strcmp(argv[i], "time"))
+            bench.time_s = strtod(value, NULL);
+        else if (!strcmp(argv[i], "size"))
+            bench.size = strtoul(value, NULL, 0);
+        else if (!strcmp(argv[i], "theta"))
+            bench.theta = strtod(value, NULL);
+        else if (!strcmp(argv[i], "hot"))
+            bench.hot_pct = strtoul(value, NULL, 0);
+        else if (!strcmp(argv[i], "hotio"))
+            bench.hotio_pct = strtoul(value, NULL, 0);
+        else if (!strcmp(argv[i], "seed"))
+            bench.seed = strtoul(value, NULL, 0);
+        else
+            return -1;
+    }
+
+    if (bench.bs == 0 || bench.threads == 0 || bench.qd == 0 || bench.read_pct > 100 ||
+        bench.hot_pct > 100 || bench.hotio_pct > 100 || bench.size < bench.bs)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+static void bench_print_dir(const char* name, const struct hist* h, size_t bytes, double secs, int last)
+{
+    printf("  \"%s\": {\n", name);
+    printf("    \"ops\": %llu,\n", (unsigned long long)h->total);
+    printf("    \"bytes\": %zu,\n", bytes);
+    printf("    \"iops\": %.1f,\n", secs > 0 ? h->total / secs : 0);
+    printf("    \"bw_mib_s\": %.3f,\n", secs > 0 ? bytes / secs / (1024 * 1024) : 0);
+    printf("    \"lat_ns\": {\n");
+    printf("      \"mean\": %.0f,\n", h->total ? (double)h->sum_ns / h->total : 0);
+    printf("      \"p50\": %llu,\n", (unsigned long long)hist_percentile(h, 50));
+    printf("      \"p99\": %llu,\n", (unsigned long long)hist_percentile(h, 99));
+    printf("      \"p99.9\": %llu,\n", (unsigned long long)hist_percentile(h, 99.9));
+    printf("      \"max\": %llu,\n", (unsigned long long)h->max_ns);
+    printf("      \"histogram\": [");
+    int first = 1;
+    for (int i = 0; i < HIST_BUCKETS; i++)
+    {
+        if (h->count[i])
+        {
+            printf("%s[%llu, %llu]", first ? "" : ", ",
+                   (unsigned long long)hist_bucket_upper(i), (unsigned long long)h->count[i]);
+            first = 0;
+        }
+    }
+    printf("]\n");
+    printf("    }\n");
+    printf("  }%s\n", last ? "" : ",");
+}
+
+static int do_bench(const char* path)
+{
+    struct bench_worker* workers;
+    struct hist lat[2];
+    size_t bytes[2] = { 0, 0 }, errors = 0;
+    // pread/pwrite block, so every request kept in flight takes a worker thread of its own
+    unsigned int nworkers = bench.threads * bench.qd;
+    uint64_t start, end;
+    double secs, wa = 0;
+    int fd;
+
+    fd = open(path, O_RDWR);
+    if (fd < 0)
+    {
+        perror("open");
+        return -1;
+    }
+
+    bench_blocks = bench.size / bench.bs;
+    if (bench.pattern == PATTERN_ZIPF && zipf_init())
+    {
+        close(fd);
+        return -1;
+    }
+
+    workers = calloc(nworkers, sizeof(*workers));
+    if (!workers)
+    {
+        close(fd);
+        return -1;
+    }
+
+    start = now_ns();
+    bench_deadline_ns = bench.time_s > 0 ? start + (uint64_t)(bench.time_s * 1e9) : 0;
+    for (unsigned int i = 0; i < nworkers; i++)
+    {
+        struct bench_worker* w = &workers[i];
+        w->fd = fd;
+        w->rng = (bench.seed + 1) * 0x9E3779B97F4A7C15ULL + i;
+        w->buf = malloc(bench.bs);
+        if (!w->buf)
+        {
+            fprintf(stderr, "failed to allocate %zu bytes\n", bench.bs);
+            nworkers = i;
+            break;
+        }
+        // Random, incompressible data
+        for (size_t k = 0; k < bench.bs; k++)
+        {
+            w->buf[k] = bench_rand(&w->rng);
+        }
+        if (pthread_create(&w->tid, NULL, bench_run, w))
+        {
+            fprintf(stderr, "failed to start worker %u\n", i);
+            free(w->buf);
+            nworkers = i;
+            break;
+        }
+    }
+    for (unsigned int i = 0; i < nworkers; i++)
+    {
+        pthread_join(workers[i].tid, NULL);
+    }
+    end = now_ns();
+    secs = (end - start) / 1e9;
+
+    memset(lat, 0, sizeof(lat));
+    for (unsigned int i = 0; i < nworkers; i++)
+    {
+        for (int dir = 0; dir < 2; dir++)
+        {
+            hist_merge(&lat[dir], &workers[i].lat[dir]);
+            bytes[dir] += workers[i].bytes[dir];
+        }
+        errors += workers[i].errors;
+        free(workers[i].buf);
+    }
+    free(workers);
+    free(zipf_cdf);
+
+    if (ioctl(fd, SSD_GET_WA, &wa))
+    {
+        perror("ioctl");
+    }
+    close(fd);
+
+    printf("{\n");
+    printf("  \"pattern\": \"%s\",\n", pattern_names[bench.pattern]);
+    printf("  \"bs\": %zu,\n", bench.bs);
+    printf("  \"read_pct\": %u,\n", bench.read_pct);
+    printf("  \"threads\": %u,\n", bench.threads);
+    printf("  \"qd\": %u,\n", bench.qd);
+    printf("  \"size\": %zu,\n", bench.size);
+    printf("  \"runtime_s\": %.6f,\n", secs);
+    printf("  \"errors\": %zu,\n", errors);
+    printf("  \"iops\": %.1f,\n", secs > 0 ? (lat[0].total + lat[1].total) / secs : 0);
+    printf("  \"bw_mib_s\": %.3f,\n", secs > 0 ? (bytes[0] + bytes[1]) / secs / (1024 * 1024) : 0);
+    printf("  \"write_amplification\": %f,\n", wa);
+    bench_print_dir("read", &lat[0], bytes[0], secs, 0);
+    bench_print_dir("write", &lat[1], bytes[1], secs, 1);
+    printf("}\n");
+    return errors ? -1 : 0;
+}
+enum
+{
+    TRACE_AUTO,
+    TRACE_BLKPARSE,
+    TRACE_MSR,
+};
+static const char* trace_format_names[] = { "auto", "blkparse", "msr" };
+
+struct replay_opts
+{
+    int format;
+    char action;
+    double speed;
+    double window_s;
+    size_t size;
+    size_t span;
+};
+
+struct trace_io
+{
+    double time_s;
+    int is_write;
+    unsigned long long offset;
+    size_t len;
+};
+
+// Device counters sampled at window boundaries
+struct ssd_counters
+{
+    size_t host_write;
+    size_t nand_write;
+    size_t gc_count;
+};
+
+struct replay_window
+{
+    size_t index;
+    struct hist lat[2];
+    size_t bytes[2];
+    size_t errors;
+    struct ssd_counters start;
+};
+
+static struct replay_opts replay;
+
+static int replay_parse(int argc, char** argv)
+{
+    replay.format = TRACE_AUTO;
+    replay.action = 'Q';
+    replay.speed = 1;
+    replay.window_s = 1;
+    replay.size = LOGICAL_NAND_NUM * NAND_SIZE_KB * 1024;
+    replay.span = 0;
+
+    for (int i = 0; i < argc; i++)
+    {
+        char* value = strchr(argv[i], '=');
+        if (!value)
+        {
+            return -1;
+        }
+        *value++ = '\0';
+
+        if (!strcmp(argv[i], "format"))
+        {
+            size_t f;
+            for (f = 0; f < sizeof(trace_format_names) / sizeof(trace_format_names[0]); f++)
+            {
+                if (!strcmp(value, trace_format_names[f]))
+                {
+                    break;
+                }
+            }
+            if (f == sizeof(trace_format_names) / sizeof(trace_format_names[0]))
+            {
+                return -1;
+            }
+            replay.format = f;
+        }
+        else if (!strcmp(argv[i], "action"))
+            replay.action = value[0];
+        else if (!strcmp(argv[i], "speed"))
+            replay.speed = strtod(value, NULL);
+        else if (!strcmp(argv[i], "window"))
+            replay.window_s = strtod(value, NULL);
+        else if (!strcmp(argv[i], "size"))
+            replay.size = strtoul(value, NULL, 0);
+        else if (!strcmp(argv[i], "span"))
+            replay.span = strtoull(value, NULL, 0);
+        else
+            return -1;
+    }
+
+    if (replay.speed < 0 || replay.window_s <= 0 || replay.size == 0)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+// Parse one line of blkparse text output, e.g.
+//   8,0    3        1     0.000000000   697  Q   W 223490 + 8 [kjournald]
+static int trace_parse_blkparse(const char* line, struct trace_io* io)
+{
+    char action[8], rwbs[16];
+    unsigned long long sector;
+    size_t sectors;
+
+    if (sscanf(line, "%*s %*s %*s %lf %*s %7s %15s %llu + %zu",
+               &io->time_s, action, rwbs, &sector, &sectors) != 5)
+    {
+        return -1;
+    }
+    if (action[0] != replay.action || action[1] != '\0')
+    {
+        return -1;
+    }
+    // Discards and flushes are not replayed
+    if (strchr(rwbs, 'D') || (!strchr(rwbs, 'R') && !strchr(rwbs, 'W')))
+    {
+        return -1;
+    }
+    io->is_write = strchr(rwbs, 'W') != NULL;
+    io->offset = sector * 512;
+    io->len = sectors * 512;
+    return 0;
+}
+
+// Parse one line of an MSR Cambridge trace as published by SNIA:
+//   Timestamp,Hostname,DiskNumber,Type,Offset,Size,ResponseTime
+// with the timestamp in 100 ns units
+static int trace_parse_msr(const char* line, struct trace_io* io)
+{
+    unsigned long long timestamp;
+    char type[16];
+
+    if (sscanf(line, "%llu,%*[^,],%*[^,],%15[^,],%llu,%zu",
+               &timestamp, type, &io->offset, &io->len) != 4)
+    {
+        return -1;
+    }
+    if (tolower(type[0]) != 'r' && tolower(type[0]) != 'w')
+    {
+        return -1;
+    }
+    io->is_write = tolower(type[0]) == 'w';
+    io->time_s = timestamp * 1e-7;
+    return 0;
+}
+
+// Map a trace request into the emulated logical region, 0 if nothing of it is left
+static int trace_map(struct trace_io* io)
+{
+    if (replay.span)
+    {
+        io->offset = (unsigned long long)((long double)io->offset * replay.size / replay.span);
+    }
+    io->offset %= replay.size;
+    if (io->len > replay.size - io->offset)
+    {
+        io->len = replay.size - io->offset;
+    }
+    return io->len > 0;
+}
+
+static void ssd_read_counters(int fd, struct ssd_counters* c)
+{
+    memset(c, 0, sizeof(*c));
+    if (ioctl(fd, SSD_GET_HOST_WRITE, &c->host_write) ||
+        ioctl(fd, SSD_GET_NAND_WRITE, &c->nand_write) ||
+        ioctl(fd, SSD_GET_GC_COUNT, &c->gc_count))
+    {
+        memset(c, 0, sizeof(*c));
+    }
+}
+
+static void replay_report(int fd, struct replay_window* win)
+{
+    struct ssd_counters now;
+    size_t host, nand;
+
+    ssd_read_counters(fd, &now);
+    host = now.host_write - win->start.host_write;
+    nand = now.nand_write - win->start.nand_write;
+
+    printf("{\"window\": %zu, \"start_s\": %.3f", win->index, win->index * replay.window_s);
+    for (int dir = 0; dir < 2; dir++)
+    {
+        const char* name = dir ? "write" : "read";
+        const struct hist* h = &win->lat[dir];
+        printf(", \"%s_ops\": %llu, \"%s_bytes\": %zu, \"%s_p50_ns\": %llu, \"%s_p99_ns\": %llu, \"%s_max_ns\": %llu",
+               name, (unsigned long long)h->total, name, win->bytes[dir],
+               name, (unsigned long long)hist_percentile(h, 50),
+               name, (unsigned long long)hist_percentile(h, 99),
+               name, (unsigned long long)h->max_ns);
+    }
+    printf(", \"errors\": %zu, \"wa\": %.4f, \"gc\": %zu, \"total_wa\": %.4f, \"total_gc\": %zu}\n",
+           win->errors, host ? (double)nand / host : 0, now.gc_count - win->start.gc_count,
+           now.host_write ? (double)now.nand_write / now.host_write : 0, now.gc_count);
+    fflush(stdout);
+
+    memset(win->lat, 0, sizeof(win->lat));
+    memset(win->bytes, 0, sizeof(win->bytes));
+    win->errors = 0;
+    win->start = now;
+}
+
+static int do_replay(const char* path, const char* trace)
+{
+    struct replay_window win;
+    struct trace_io io;
+    FILE* tf;
+    char* line = NULL;
+    size_t line_cap = 0;
+    char* buf = NULL;
+    size_t buf_len = 0;
+    double t0 = -1;
+    uint64_t start_ns = 0;
+    size_t replayed = 0, skipped = 0, errors = 0;
+    int fd, in_window = 0;
+
+    tf = strcmp(trace, "-") ? fopen(trace, "r") : stdin;
+    if (!tf)
+    {
+        perror("open trace");
+        return -1;
+    }
+    fd = open(path, O_RDWR);
+    if (fd < 0)
+    {
+        perror("open");
+        if (tf != stdin)
+        {
+            fclose(tf);
+        }
+        return -1;
+    }
+
+    memset(&win, 0, sizeof(win));
+
+    // The trace is processed one line at a time, so its size is not limited by memory
+    while (getline(&line, &line_cap, tf) > 0)
+    {
+        int format = replay.format;
+        uint64_t start, end;
+        ssize_t ret;
+
+        // MSR lines have six commas, blkparse lines at most the one of the device number
+        if (format == TRACE_AUTO)
+        {
+            int commas = 0;
+            for (const char* c = line; *c; c++)
+            {
+                commas += *c == ',';
+            }
+            format = commas >= 5 ? TRACE_MSR : TRACE_BLKPARSE;
+        }
+        if ((format == TRACE_MSR ? trace_parse_msr(line, &io) : trace_parse_blkparse(line, &io)) || !trace_map(&io))
+        {
+            skipped++;
+            continue;
+        }
+
+        if (t0 < 0)
+        {
+            t0 = io.time_s;
+            start_ns = now_ns();
+            ssd_read_counters(fd, &win.start);
+        }
+
+        // Close the windows the trace moved past
+        size_t index = io.time_s > t0 ? (size_t)((io.time_s - t0) / replay.window_s) : 0;
+        if (index != win.index)
+        {
+            if (in_window)
+            {
+                replay_report(fd, &win);
+            }
+            win.index = index;
+        }
+        in_window = 1;
+
+        // Wait for the scaled issue time of the request
+        if (replay.speed > 0 && io.time_s > t0)
+        {
+            uint64_t target = start_ns + (uint64_t)((io.time_s - t0) * 1e9 / replay.speed);
+            uint64_t now = now_ns();
+            if (target > now)
+            {
+                struct timespec ts = { (target - now) / 1000000000ULL, (target - now) % 1000000000ULL };
+                nanosleep(&ts, NULL);
+            }
+        }
+
+        if (io.len > buf_len)
+        {
+            char* tmp = realloc(buf, io.len);
+            if (!tmp)
+            {
+                fprintf(stderr, "failed to allocate %zu bytes\n", io.len);
+                errors++;
+                break;
+            }
+            for (size_t k = buf_len; k < io.len; k++)
+            {
+                tmp[k] = rand();
+            }
+            buf = tmp;
+            buf_len = io.len;
+        }
+
+        start = now_ns();
+        if (io.is_write)
+        {
+            ret = pwrite(fd, buf, io.len, io.offset);
+        }
+        else
+        {
+            ret = pread(fd, buf, io.len, io.offset);
+        }
+        end = now_ns();
+
+        if (ret < 0)
+        {
+            win.errors++;
+            errors++;
+            continue;
+        }
+        hist_add(&win.lat[io.is_write], end - start);
+        win.bytes[io.is_write] += ret;
+        replayed++;
+    }
+    if (in_window)
+    {
+        replay_report(fd, &win);
+    }
+
+    printf("{\"replayed\": %zu, \"skipped_lines\": %zu, \"errors\": %zu, \"runtime_s\": %.3f}\n",
+           replayed, skipped, errors, start_ns ? (now_ns() - start_ns) / 1e9 : 0);
+
+    free(line);
+    free(buf);
+    close(fd);
+    if (tf != stdin)
+    {
+        fclose(tf);
+    }
+    return errors ? -1 : 0;
+}
+
 static int do_rw(FILE* fd, int is_read, size_t size, off_t offset)
 {
     char* buf;
-    int idx;
+    size_t idx;
     ssize_t ret;
     buf = calloc(1, size);
 
     if (!buf)
     {
-        fprintf(stderr, "failed to allocated %zu bytes\n", size);
+        fprintf(stderr, "failed to allocate %zu bytes\n", size);
         return -1;
     }
     if (is_read)
@@ -70,6 +920,227 @@ static int do_rw(FILE* fd, int is_read, size_t size, off_t offset)
     free(buf);
     return ret;
 }
+static const char* stats_lat_names[SSD_LAT_NUM] = { "host_read", "host_write", "gc", "erase" };
+
+// Upper bound of the log2 bucket a percentile falls into
+static uint64_t stats_percentile(const struct ssd_lat_hist* h, double pct)
+{
+    uint64_t target = (uint64_t)ceil(h->total * pct / 100.0);
+    uint64_t seen = 0;
+
+    for (int i = 0; i < SSD_STATS_HIST_BUCKETS; i++)
+    {
+        seen += h->count[i];
+        if (seen >= target && seen > 0)
+        {
+            uint64_t upper = (2ULL << i) - 1;
+            return upper < h->max_ns ? upper : h->max_ns;
+        }
+    }
+    return h->max_ns;
+}
+
+static int do_stats(const char* path)
+{
+    struct ssd_stats st;
+    int fd;
+
+    fd = open(path, O_RDWR);
+    if (fd < 0)
+    {
+        perror("open");
+        return -1;
+    }
+    if (ioctl(fd, SSD_GET_STATS, &st))
+    {
+        perror("ioctl");
+        close(fd);
+        return -1;
+    }
+    close(fd);
+
+    printf("{\n");
+    printf("  \"host_read\": { \"ops\": %llu, \"bytes\": %llu },\n",
+           (unsigned long long)st.host_read_ops, (unsigned long long)st.host_read_bytes);
+    printf("  \"host_write\": { \"ops\": %llu, \"bytes\": %llu },\n",
+           (unsigned long long)st.host_write_ops, (unsigned long long)st.host_write_bytes);
+    printf("  \"nand_read\": { \"ops\": %llu, \"bytes\": %llu },\n",
+           (unsigned long long)st.nand_read_ops, (unsigned long long)st.nand_read_bytes);
+    printf("  \"nand_write\": { \"ops\": %llu, \"bytes\": %llu },\n",
+           (unsigned long long)st.nand_write_ops, (unsigned long long)st.nand_write_bytes);
+    printf("  \"gc\": { \"count\": %llu, \"pages_relocated\": %llu, \"preemptions\": %llu },\n",
+           (unsigned long long)st.gc_count, (unsigned long long)st.gc_pages_relocated,
+           (unsigned long long)st.gc_preemptions);
+    printf("  \"nand_suspends\": %llu,\n", (unsigned long long)st.nand_suspends);
+    printf("  \"packed\": { \"pages\": %llu, \"lbas\": %llu },\n",
+           (unsigned long long)st.packed_pages, (unsigned long long)st.packed_lbas);
+    printf("  \"dedup\": { \"lbas\": %llu, \"zero_lbas\": %llu },\n",
+           (unsigned long long)st.dedup_lbas, (unsigned long long)st.zero_lbas);
+    printf("  \"slc\": { \"host_pages\": %llu, \"bypass_pages\": %llu, \"folded_pages\": %llu, \"folds\": %llu },\n",
+           (unsigned long long)st.slc_host_pages, (unsigned long long)st.slc_bypass_pages,
+           (unsigned long long)st.slc_folded_pages, (unsigned long long)st.slc_folds);
+    printf("  \"erase\": { \"total\": %llu, \"min\": %u, \"max\": %u, \"mean\": %.2f, \"blocks\": [",
+           (unsigned long long)st.erase_total, st.erase_min, st.erase_max, st.erase_mean);
+    for (int i = 0; i < PHYSICAL_NAND_NUM; i++)
+    {
+        printf("%s%u", i ? ", " : "", st.erase_counts[i]);
+    }
+    printf("] },\n");
+    printf("  \"free_blocks\": %u,\n", st.free_blocks);
+    printf("  \"mixed_blocks\": %u,\n", st.mixed_blocks);
+    printf("  \"snapshots\": { \"count\": %u, \"pages\": %u, \"list\": [", st.snapshots, st.snapshot_pages);
+    for (uint32_t i = 0, first = 1; i < SSD_SNAPSHOT_MAX; i++)
+    {
+        const struct ssd_snapshot_stats* ss = &st.snap[i];
+
+        if (ss->used)
+        {
+            printf("%s{ \"snapshot\": %u, \"volume\": %u, \"logic_size\": %llu, \"mapped_lbas\": %u }",
+                   first ? "" : ", ", i, ss->volume, (unsigned long long)ss->logic_size, ss->mapped_lbas);
+            first = 0;
+        }
+    }
+    printf("] },\n");
+    printf("  \"volumes\": [\n");
+    for (uint32_t v = 0; v < st.volumes && v < SSD_VOLUME_MAX; v++)
+    {
+        const struct ssd_volume_stats* vs = &st.vol[v];
+
+        printf("    { \"volume\": %u, \"capacity\": %llu, \"logic_size\": %llu, \"mapped_lbas\": %u, \"blocks\": %u, "
+               "\"host_read\": { \"ops\": %llu, \"bytes\": %llu }, \"host_write\": { \"ops\": %llu, \"bytes\": %llu }, "
+               "\"nand_write_ops\": %llu, \"gc_pages_relocated\": %llu, \"shared_pages\": %llu, "
+               "\"read_p99_ns\": %llu, \"write_p99_ns\": %llu }%s\n",
+               v, (unsigned long long)vs->capacity, (unsigned long long)vs->logic_size, vs->mapped_lbas, vs->blocks,
+               (unsigned long long)vs->host_read_ops, (unsigned long long)vs->host_read_bytes,
+               (unsigned long long)vs->host_write_ops, (unsigned long long)vs->host_write_bytes,
+               (unsigned long long)vs->nand_write_ops, (unsigned long long)vs->gc_pages_relocated,
+               (unsigned long long)vs->shared_pages,
+               (unsigned long long)stats_percentile(&vs->read_lat, 99),
+               (unsigned long long)stats_percentile(&vs->write_lat, 99),
+               v + 1 == st.volumes ? "" : ",");
+    }
+    printf("  ],\n");
+    printf("  \"lat_ns\": {\n");
+    for (int k = 0; k < SSD_LAT_NUM; k++)
+    {
+        const struct ssd_lat_hist* h = &st.lat[k];
+        int first = 1;
+
+        printf("    \"%s\": { \"ops\": %llu, \"mean\": %.0f, \"p50\": %llu, \"p99\": %llu, \"max\": %llu, \"histogram\": [",
+               stats_lat_names[k], (unsigned long long)h->total,
+               h->total ? (double)h->sum_ns / h->total : 0,
+               (unsigned long long)stats_percentile(h, 50), (unsigned long long)stats_percentile(h, 99),
+               (unsigned long long)h->max_ns);
+        for (int i = 0; i < SSD_STATS_HIST_BUCKETS; i++)
+        {
+            if (h->count[i])
+            {
+                printf("%s[%llu, %llu]", first ? "" : ", ",
+                       (unsigned long long)((2ULL << i) - 1), (unsigned long long)h->count[i]);
+                first = 0;
+            }
+        }
+        printf("] }%s\n", k + 1 == SSD_LAT_NUM ? "" : ",");
+    }
+    printf("  }\n");
+    printf("}\n");
+    return 0;
+}
+
+static const char* zone_state_names[] = { "empty", "implicit_open", "explicit_open", "closed", "full" };
+
+static int do_zone_report(const char* path)
+{
+    struct ssd_zone_report report;
+    int fd;
+
+    fd = open(path, O_RDWR);
+    if (fd < 0)
+    {
+        perror("open");
+        return -1;
+    }
+    if (ioctl(fd, SSD_ZONE_REPORT, &report))
+    {
+        perror("ioctl");
+        close(fd);
+        return -1;
+    }
+    close(fd);
+
+    printf("[\n");
+    for (uint32_t i = 0; i < report.nr_zones; i++)
+    {
+        const struct ssd_zone* z = &report.zones[i];
+        printf("  { \"zone\": %u, \"start\": %llu, \"len\": %llu, \"wp\": %llu, \"state\": \"%s\", \"block\": %d }%s\n",
+               i, (unsigned long long)z->start, (unsigned long long)z->len, (unsigned long long)z->wp,
+               z->state <= SSD_ZONE_FULL ? zone_state_names[z->state] : "?", z->block,
+               i + 1 == report.nr_zones ? "" : ",");
+    }
+    printf("]\n");
+    return 0;
+}
+
+static int do_zone_mgmt(const char* path, const char* op, uint64_t zone)
+{
+    unsigned int cmd;
+    int fd;
+
+    if (!strcmp(op, "open"))
+        cmd = SSD_ZONE_OPEN;
+    else if (!strcmp(op, "close"))
+        cmd = SSD_ZONE_CLOSE;
+    else if (!strcmp(op, "finish"))
+        cmd = SSD_ZONE_FINISH;
+    else if (!strcmp(op, "reset"))
+        cmd = SSD_ZONE_RESET;
+    else
+    {
+        fprintf(stderr, "unknown zone operation %s\n", op);
+        return -1;
+    }
+
+    fd = open(path, O_RDWR);
+    if (fd < 0)
+    {
+        perror("open");
+        return -1;
+    }
+    if (ioctl(fd, cmd, &zone))
+    {
+        perror("ioctl");
+        close(fd);
+        return -1;
+    }
+    close(fd);
+    return 0;
+}
+
+// Snapshot and clone ioctls, arg is the snapshot or the source volume and gets the number of a new snapshot
+static int do_snapshot(const char* path, unsigned int cmd, uint64_t arg)
+{
+    int fd;
+
+    fd = open(path, O_RDWR);
+    if (fd < 0)
+    {
+        perror("open");
+        return -1;
+    }
+    if (ioctl(fd, cmd, &arg))
+    {
+        perror("ioctl");
+        close(fd);
+        return -1;
+    }
+    close(fd);
+    if (cmd == SSD_SNAPSHOT_CREATE)
+    {
+        printf("%llu\n", (unsigned long long)arg);
+    }
+    return 0;
+}
+
 int main(int argc, char** argv)
 {
     size_t param[2] = { };
@@ -88,6 +1159,77 @@ int main(int argc, char** argv)
     cmd = argv[2][0];
     argc -= 3;
     argv += 3;
+    if (cmd == 'b')
+    {
+        if (bench_parse(argc, argv))
+        {
+            goto usage;
+        }
+        return do_bench(path) ? 1 : 0;
+    }
+    if (cmd == 't')
+    {
+        if (argc < 1 || replay_parse(argc - 1, argv + 1))
+        {
+            goto usage;
+        }
+        return do_replay(path, argv[0]) ? 1 : 0;
+    }
+    if (cmd == 'Z')
+    {
+        char* endp;
+        if (argc != 2)
+        {
+            goto usage;
+        }
+        uint64_t zone = strtoull(argv[1], &endp, 0);
+        if (endp == argv[1] || *endp != '\0')
+        {
+            goto usage;
+        }
+        return do_zone_mgmt(path, argv[0], zone) ? 1 : 0;
+    }
+    if (cmd == 'S' || cmd == 'C')
+    {
+        unsigned int ioc = SSD_CLONE;
+        uint64_t arg = 0;
+        char* endp;
+
+        if (cmd == 'S')
+        {
+            if (argc < 1)
+            {
+                goto usage;
+            }
+            if (!strcmp(argv[0], "create"))
+                ioc = SSD_SNAPSHOT_CREATE;
+            else if (!strcmp(argv[0], "delete"))
+                ioc = SSD_SNAPSHOT_DELETE;
+            else if (!strcmp(argv[0], "restore"))
+                ioc = SSD_SNAPSHOT_RESTORE;
+            else
+                goto usage;
+            argc--;
+            argv++;
+        }
+        if (argc != (ioc == SSD_SNAPSHOT_CREATE ? 0 : 1))
+        {
+            goto usage;
+        }
+        if (argc)
+        {
+            arg = strtoull(argv[0], &endp, 0);
+            if (endp == argv[0] || *endp != '\0')
+            {
+                goto usage;
+            }
+        }
+        return do_snapshot(path, ioc, arg) ? 1 : 0;
+    }
+    if (argc > 2)
+    {
+        goto usage;
+    }
     for (i = 0; i < argc; i++)
     {
         char* endp;
@@ -161,6 +1303,10 @@ int main(int argc, char** argv)
             printf("%f\n", wa);
             close(fd);
             return 0;
+        case 's':
+            return do_stats(path) ? 1 : 0;
+        case 'z':
+            return do_zone_report(path) ? 1 : 0;
     }
 usage:
     fprintf(stderr, "%s", usage);
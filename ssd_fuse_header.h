@@ -5,10 +5,13 @@
   This program can be distributed under the terms of the GNU GPLv2.
   See the file COPYING.
 */
+#ifndef SSD_FUSE_HEADER_H
+#define SSD_FUSE_HEADER_H
 #include <sys/types.h>
 #include <sys/uio.h>
 #include <sys/ioctl.h>
 #include <limits.h>
+#include <stdint.h>
 #define PHYSICAL_NAND_NUM (8)
 #define LOGICAL_NAND_NUM (5)
 #define NAND_SIZE_KB (10)
@@ -16,11 +19,157 @@
 #define FULL_PCA     (0xFFFFFFFFU)
 #define INVALID_LBA (0xFFFFFFFFU)
 #define PAGES_PER_BLOCK (NAND_SIZE_KB * 1024 / 512)
+#define SLC_PAGES_PER_BLOCK (PAGES_PER_BLOCK / 3) // Pages a TLC block holds in SLC mode
+// NAND timing model
+#define NAND_READ_LATENCY_US  (50)
+#define NAND_PROG_LATENCY_US  (500)
+#define NAND_SLC_PROG_LATENCY_US (150) // Program of a block of the SLC cache, one bit per cell
+#define NAND_ERASE_LATENCY_US (3000)
+#define NAND_SUSPEND_LATENCY_US (20) // Time for a program or erase to suspend in favor of a read
+#define NAND_SUSPEND_POLL_US  (20)   // How often a suspendable operation looks for waiting reads
 #define NAND_LOCATION  "/home/stanwang/Desktop/NAND_Flash_Emulation/nand"
 
+// Latency histograms, bucket i counts operations that took [2^i, 2^(i+1)) ns, bucket 0 also counts 0 ns
+#define SSD_STATS_HIST_BUCKETS (40)
+enum
+{
+    SSD_LAT_HOST_READ,
+    SSD_LAT_HOST_WRITE,
+    SSD_LAT_GC,
+    SSD_LAT_ERASE,
+    SSD_LAT_NUM,
+};
+
+struct ssd_lat_hist
+{
+    uint64_t count[SSD_STATS_HIST_BUCKETS];
+    uint64_t total;
+    uint64_t sum_ns;
+    uint64_t max_ns;
+};
+
+// Volumes sharing the NAND (-o volumes=N), volume i of N covers the LBAs [i, i + 1) * (logical LBAs / N)
+#define SSD_VOLUME_MAX (4)
+
+// Statistics of one volume
+struct ssd_volume_stats
+{
+    uint64_t host_read_ops;
+    uint64_t host_read_bytes;
+    uint64_t host_write_ops;
+    uint64_t host_write_bytes;
+    uint64_t nand_write_ops;      // Pages of the volume programmed, including GC relocations
+    uint64_t gc_pages_relocated;  // Pages of the volume copied out of GC victims
+    uint64_t shared_pages;        // Pages written to a block of another volume, no erased block was left
+    uint64_t logic_size;          // Bytes of the volume in use
+    uint64_t capacity;            // Bytes the volume may grow to
+    uint32_t mapped_lbas;
+    uint32_t blocks;              // Blocks holding valid data of the volume
+    struct ssd_lat_hist read_lat;
+    struct ssd_lat_hist write_lat;
+};
+
+// Snapshots of a volume (SSD_SNAPSHOT_CREATE) copy its mapping table only, they share its pages until they are overwritten
+#define SSD_SNAPSHOT_MAX (4)
+
+// Statistics of one snapshot slot
+struct ssd_snapshot_stats
+{
+    uint32_t used;
+    uint32_t volume;              // Volume the snapshot was taken of
+    uint64_t logic_size;          // Bytes of the volume in use when it was taken
+    uint32_t mapped_lbas;
+    uint32_t reserved;
+};
+
+// Statistics since the device was opened, latencies are wall clock and include the simulated NAND time with -o timing
+struct ssd_stats
+{
+    uint64_t host_read_ops;
+    uint64_t host_read_bytes;
+    uint64_t host_write_ops;
+    uint64_t host_write_bytes;
+    uint64_t nand_read_ops;       // Pages read, including GC reads
+    uint64_t nand_read_bytes;
+    uint64_t nand_write_ops;      // Pages programmed, including GC relocations
+    uint64_t nand_write_bytes;
+    uint64_t gc_count;            // GC invocations that freed a block
+    uint64_t gc_pages_relocated;  // Valid pages copied out of GC victims
+    uint64_t erase_total;         // Block erases
+    uint64_t gc_preemptions;      // Times GC stepped aside between two pages for host reads
+    uint64_t nand_suspends;       // Programs and erases suspended for host reads, only with -o timing
+    uint64_t packed_pages;        // Pages of compressed host data programmed, with -o compress
+    uint64_t packed_lbas;         // LBAs written compressed into them
+    uint64_t dedup_lbas;          // LBAs mapped to data already on NAND instead of written, with -o dedup
+    uint64_t zero_lbas;           // All-zero LBAs unmapped instead of written, with -o dedup
+    uint64_t slc_host_pages;      // Host pages written to the SLC cache, with -o slc
+    uint64_t slc_bypass_pages;    // Host pages written to the main blocks while the cache was full
+    uint64_t slc_folded_pages;    // Pages folded from the cache into the main blocks
+    uint64_t slc_folds;           // Cache blocks folded and erased
+    uint32_t free_blocks;         // Blocks with every page erased
+    uint32_t erase_min;           // Erase count distribution over all blocks, including erases before this open
+    uint32_t erase_max;
+    uint32_t erase_counts[PHYSICAL_NAND_NUM];
+    double erase_mean;
+    struct ssd_lat_hist lat[SSD_LAT_NUM];
+    uint32_t volumes;
+    uint32_t mixed_blocks;        // Blocks holding valid data of more than one volume
+    struct ssd_volume_stats vol[SSD_VOLUME_MAX];
+    uint32_t snapshots;           // Snapshots in use
+    uint32_t snapshot_pages;      // Valid pages no LBA maps any more, only snapshots hold them
+    struct ssd_snapshot_stats snap[SSD_SNAPSHOT_MAX];
+};
+
+// Zoned namespace (-o zns), zone i is backed by one physical block and covers bytes [i, i + 1) * SSD_ZONE_SIZE
+#define SSD_ZONE_NUM  (LOGICAL_NAND_NUM)
+#define SSD_ZONE_SIZE (NAND_SIZE_KB * 1024)
+enum
+{
+    SSD_ZONE_EMPTY,
+    SSD_ZONE_IMPLICIT_OPEN, // Opened by a write
+    SSD_ZONE_EXPLICIT_OPEN, // Opened by SSD_ZONE_OPEN
+    SSD_ZONE_CLOSED,
+    SSD_ZONE_FULL,
+};
+
+struct ssd_zone
+{
+    uint64_t start; // Byte offset of the zone
+    uint64_t len;
+    uint64_t wp;    // Byte offset the next write to the zone has to start at
+    uint32_t state;
+    int32_t block;  // Physical block behind the zone, -1 while it has none
+};
+
+struct ssd_zone_report
+{
+    uint32_t nr_zones;
+    uint32_t reserved;
+    struct ssd_zone zones[SSD_ZONE_NUM];
+};
+
 enum
 {
     SSD_GET_LOGIC_SIZE   = _IOR('E', 0, size_t),
     SSD_GET_PHYSIC_SIZE   = _IOR('E', 1, size_t),
     SSD_GET_WA            = _IOR('E', 2, size_t),
+    SSD_GET_GC_COUNT      = _IOR('E', 3, size_t),
+    SSD_GET_HOST_WRITE    = _IOR('E', 4, size_t),
+    SSD_GET_NAND_WRITE    = _IOR('E', 5, size_t),
+    SSD_GET_STATS         = _IOR('E', 6, struct ssd_stats),
+    SSD_ZONE_REPORT       = _IOR('E', 7, struct ssd_zone_report),
+    // Zone management, the argument is the zone number
+    SSD_ZONE_OPEN         = _IOW('E', 8, uint64_t),
+    SSD_ZONE_CLOSE        = _IOW('E', 9, uint64_t),
+    SSD_ZONE_FINISH       = _IOW('E', 10, uint64_t),
+    SSD_ZONE_RESET        = _IOW('E', 11, uint64_t),
+    // Snapshots of the volume of the file: create returns the snapshot number, delete and restore take it.
+    // Restoring a snapshot taken of another volume clones it into this one.
+    SSD_SNAPSHOT_CREATE   = _IOR('E', 12, uint64_t),
+    SSD_SNAPSHOT_DELETE   = _IOW('E', 13, uint64_t),
+    SSD_SNAPSHOT_RESTORE  = _IOW('E', 14, uint64_t),
+    // Clone the volume given into the volume of the file, both share their pages until they are overwritten
+    SSD_CLONE             = _IOW('E', 15, uint64_t),
 };
+
+#endif
@@ -0,0 +1,691 @@
+/*
+  ssd_sim: standalone FTL simulator
+  Drives one or more SSD devices through the FTL library without FUSE,
+  every device runs its workload on a thread of its own.
+  This program can be distributed under the terms of the GNU GPLv2.
+  See the file COPYING.
+*/
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <time.h>
+#include "ssd_ftl.h"
+const char* usage =
+    "Usage: ssd_sim [NAME=VALUE ...]\n"
+    "\n"
+    "OPTIONS\n"
+    "  devices=N       independent devices simulated in parallel (dfl 1)\n"
+    "  pattern=seq|rand|zipf|hotcold  access pattern (dfl rand)\n"
+    "  bs=BYTES        request size (dfl 512)\n"
+    "  read=PCT        percentage of reads in the mix (dfl 0)\n"
+    "  ops=N           requests per device (dfl 1000000)\n"
+    "  size=BYTES      size of the region accessed in every volume (dfl size of a volume)\n"
+    "  theta=F         zipf skew (dfl 0.99)\n"
+    "  hot=PCT         hotcold: percentage of the region that is hot (dfl 20)\n"
+    "  hotio=PCT       hotcold: percentage of requests going to the hot part (dfl 80)\n"
+    "  seed=N          random seed, device i uses seed + i (dfl 1)\n"
+    "  nand=DIR        keep the NAND of device i in DIR/dev<i> instead of memory\n"
+    "  timing=0|1      wait for the simulated NAND latency (dfl 0)\n"
+    "  ecc=0|1         inject and decode raw bit errors (dfl 0)\n"
+    "  ecc_rber=F      raw bit error rate of a fresh block\n"
+    "  gc_pace=0|1     spread GC over host writes (dfl 1)\n"
+    "  compress=0|1    compress LBAs and pack them several to a page, those of one request\n"
+    "                  right away and single ones once GC relocates them (dfl 0)\n"
+    "  entropy=PCT     random bytes in every 512 written, the rest are zeros (dfl 100)\n"
+    "  dedup=0|1       map data already on NAND instead of writing it again (dfl 0)\n"
+    "  dup=PCT         512 byte sectors written that repeat earlier data, the others are\n"
+    "                  made unique (dfl 100, every request writes the same data)\n"
+    "  slc=N           blocks run as an SLC write cache, taken from the 3 spare blocks GC works\n"
+    "                  with, at most 2 (dfl 0)\n"
+    "  slc_idle=MS     idle time of host writes before the SLC cache is folded (dfl 10)\n"
+    "  burst=N         requests issued back to back before the device is left idle (dfl 0, never idle)\n"
+    "  idle=MS         idle time after every burst, the SLC cache is folded meanwhile when it is\n"
+    "                  longer than slc_idle (dfl 0)\n"
+    "  volumes=N       volumes sharing the NAND, each request goes to one of them (dfl 1)\n"
+    "  noisy=PCT       percentage of requests going to volume 0, the others share the rest\n"
+    "                  (dfl an equal share for every volume)\n"
+    "  snap=N          snapshot the volume of every Nth request, the oldest snapshot is deleted\n"
+    "                  once all are taken, pages they hold count against the free space (dfl 0)\n"
+    "  zns=0|1         zoned namespace, a zone is reset before it is written again\n"
+    "                  from its start, other writes have to be sequential (dfl 0)\n"
+    "  verify=0|1      check every read against the data written, a mismatch fails the run (dfl 0)\n"
+    "  verbose=0|1     log every FTL operation (dfl 0)\n"
+    "\n";
+
+enum
+{
+    PATTERN_SEQ,
+    PATTERN_RAND,
+    PATTERN_ZIPF,
+    PATTERN_HOTCOLD,
+};
+static const char* pattern_names[] = { "seq", "rand", "zipf", "hotcold" };
+
+struct sim_opts
+{
+    unsigned int devices;
+    int pattern;
+    size_t bs;
+    unsigned int read_pct;
+    size_t ops;
+    size_t size;
+    double theta;
+    unsigned int hot_pct;
+    unsigned int hotio_pct;
+    unsigned int seed;
+    unsigned int entropy_pct;
+    unsigned int dup_pct;
+    size_t burst;
+    unsigned int idle_ms;
+    int noisy_pct;
+    size_t snap;
+    int verify;
+    const char* nand;
+    struct ssd_config cfg;
+};
+
+struct sim_device
+{
+    pthread_t tid;
+    unsigned int idx;
+    char nand_dir[PATH_MAX];
+    struct ssd_dev* dev;
+    uint64_t rng;
+    size_t seq_block;
+    char* buf;      // Data every write sends, reads go to rbuf so they leave it as it was generated
+    char* rbuf;
+    uint64_t stamp; // Last number written into a sector to make it unique
+    size_t ops[2];   // 0 read, 1 write
+    size_t bytes[2];
+    size_t errors;
+    size_t mismatches;
+    char* shadow; // Data of every volume as the host last wrote it, kept with verify
+    double secs;
+    int snap_ids[SSD_SNAPSHOT_MAX]; // Snapshot number i % SSD_SNAPSHOT_MAX taken
+    size_t snaps_taken;
+    size_t snaps_live;
+    uint64_t snap_ns_sum;
+    uint64_t snap_ns_max;
+};
+
+static struct sim_opts sim;
+static size_t sim_blocks; // Number of bs sized blocks in the region
+static double* zipf_cdf;  // Cumulative zipf probability of every block rank, shared by all devices
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// xorshift64* generator, one per device
+static uint64_t sim_rand(uint64_t* state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+// Uniform double in [0, 1)
+static double sim_rand_unit(uint64_t* state)
+{
+    return (sim_rand(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// Block rank tables of the zipf pattern, rank 0 being the most popular block
+static int zipf_init()
+{
+    double sum = 0;
+
+    zipf_cdf = malloc(sim_blocks * sizeof(*zipf_cdf));
+    if (!zipf_cdf)
+    {
+        return -1;
+    }
+    for (size_t i = 0; i < sim_blocks; i++)
+    {
+        sum += 1.0 / pow(i + 1, sim.theta);
+        zipf_cdf[i] = sum;
+    }
+    for (size_t i = 0; i < sim_blocks; i++)
+    {
+        zipf_cdf[i] /= sum;
+    }
+    return 0;
+}
+
+static size_t zipf_next(uint64_t* rng)
+{
+    double u = sim_rand_unit(rng);
+    size_t lo = 0, hi = sim_blocks - 1;
+
+    while (lo < hi)
+    {
+        size_t mid = (lo + hi) / 2;
+        if (zipf_cdf[mid] < u)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// Pick the block of the next request
+static size_t sim_next_block(struct sim_device* d)
+{
+    size_t hot_blocks;
+
+    switch (sim.pattern)
+    {
+        case PATTERN_SEQ:
+            return d->seq_block++ % sim_blocks;
+        case PATTERN_ZIPF:
+            return zipf_next(&d->rng);
+        case PATTERN_HOTCOLD:
+            hot_blocks = sim_blocks * sim.hot_pct / 100;
+            if (hot_blocks == 0)
+            {
+                hot_blocks = 1;
+            }
+            if (hot_blocks >= sim_blocks || sim_rand(&d->rng) % 100 < sim.hotio_pct)
+            {
+                return sim_rand(&d->rng) % hot_blocks;
+            }
+            return hot_blocks + sim_rand(&d->rng) % (sim_blocks - hot_blocks);
+        default:
+            return sim_rand(&d->rng) % sim_blocks;
+    }
+}
+
+// Pick the volume of the next request
+static unsigned int sim_next_volume(struct sim_device* d)
+{
+    if (sim.cfg.volumes < 2)
+    {
+        return 0;
+    }
+    if (sim.noisy_pct < 0)
+    {
+        return sim_rand(&d->rng) % sim.cfg.volumes;
+    }
+    if (sim_rand(&d->rng) % 100 < (unsigned int)sim.noisy_pct)
+    {
+        return 0;
+    }
+    return 1 + sim_rand(&d->rng) % (sim.cfg.volumes - 1);
+}
+
+// Snapshot a volume, the oldest snapshot is deleted first once every slot is taken
+static void sim_snapshot(struct sim_device* d, unsigned int vol)
+{
+    size_t slot = d->snaps_taken % SSD_SNAPSHOT_MAX;
+    uint64_t start;
+    int snap;
+
+    if (d->snaps_live == SSD_SNAPSHOT_MAX)
+    {
+        ssd_dev_snapshot_delete(d->dev, d->snap_ids[slot]);
+        d->snaps_live--;
+    }
+    start = now_ns();
+    snap = ssd_dev_snapshot_create(d->dev, vol);
+    if (snap < 0)
+    {
+        d->errors++;
+        return;
+    }
+    uint64_t ns = now_ns() - start;
+    d->snap_ns_sum += ns;
+    if (ns > d->snap_ns_max)
+    {
+        d->snap_ns_max = ns;
+    }
+    d->snap_ids[slot] = snap;
+    d->snaps_taken++;
+    d->snaps_live++;
+}
+
+// Give the sectors of the next write that do not repeat earlier data a number of their own
+static void sim_stamp(struct sim_device* d)
+{
+    if (sim.dup_pct == 100)
+    {
+        return;
+    }
+    for (size_t k = 0; k + sizeof(d->stamp) <= sim.bs; k += 512)
+    {
+        if (sim_rand(&d->rng) % 100 >= sim.dup_pct)
+        {
+            d->stamp++;
+            memcpy(d->buf + k, &d->stamp, sizeof(d->stamp));
+        }
+    }
+}
+
+// Refresh the shadow of a range from what the device holds, what it does not hold reads as zeros
+static void sim_shadow_load(struct sim_device* d, unsigned int vol, off_t offset, size_t len)
+{
+    char* shadow = d->shadow + vol * sim.size + offset;
+    int ret = ssd_dev_read(d->dev, vol, shadow, len, offset);
+
+    memset(shadow + (ret > 0 ? ret : 0), 0, len - (ret > 0 ? ret : 0));
+}
+
+// Compare a read with the shadow, or record a write in it
+static void sim_verify(struct sim_device* d, unsigned int vol, off_t offset, int is_read, size_t len)
+{
+    char* shadow = d->shadow + vol * sim.size + offset;
+
+    if (!is_read)
+    {
+        memcpy(shadow, d->buf, len);
+    }
+    else if (memcmp(shadow, d->rbuf, len) != 0)
+    {
+        if (d->mismatches++ == 0)
+        {
+            fprintf(stderr, "Device %u: read of volume %u at %lld returned other data than was written\n",
+                    d->idx, vol, (long long)offset);
+        }
+    }
+}
+
+static void* sim_run(void* arg)
+{
+    struct sim_device* d = arg;
+    uint64_t start = now_ns();
+
+    for (size_t op = 0; op < sim.ops; op++)
+    {
+        // Leave the device idle between bursts
+        if (sim.burst != 0 && op != 0 && op % sim.burst == 0)
+        {
+            usleep(sim.idle_ms * 1000);
+        }
+
+        unsigned int vol = sim_next_volume(d);
+        if (sim.snap != 0 && op != 0 && op % sim.snap == 0)
+        {
+            sim_snapshot(d, vol);
+        }
+        off_t offset = (off_t)sim_next_block(d) * sim.bs;
+        int is_read = sim_rand(&d->rng) % 100 < sim.read_pct;
+        int ret;
+
+        if (is_read)
+        {
+            ret = ssd_dev_read(d->dev, vol, d->rbuf, sim.bs, offset);
+        }
+        else
+        {
+            // The host of a zoned device resets a zone before it rewrites it
+            if (sim.cfg.zns && offset % SSD_ZONE_SIZE == 0 &&
+                ssd_dev_zone_mgmt(d->dev, SSD_ZONE_RESET, offset / SSD_ZONE_SIZE) == 0 && sim.verify)
+            {
+                size_t len = SSD_ZONE_SIZE < sim.size - offset ? SSD_ZONE_SIZE : sim.size - offset;
+                memset(d->shadow + offset, 0, len);
+            }
+            sim_stamp(d);
+            ret = ssd_dev_write(d->dev, vol, d->buf, sim.bs, offset);
+        }
+        if (ret < 0 || (!is_read && (size_t)ret != sim.bs))
+        {
+            d->errors++;
+            // A failed write may still have changed part of the range
+            if (sim.verify && !is_read)
+            {
+                sim_shadow_load(d, vol, offset, sim.bs);
+            }
+            continue;
+        }
+        if (sim.verify)
+        {
+            sim_verify(d, vol, offset, is_read, ret);
+        }
+        d->ops[!is_read]++;
+        d->bytes[!is_read] += ret;
+    }
+
+    d->secs = (now_ns() - start) / 1e9;
+    return NULL;
+}
+
+static int sim_parse(int argc, char** argv)
+{
+    sim.devices = 1;
+    sim.pattern = PATTERN_RAND;
+    sim.bs = 512;
+    sim.read_pct = 0;
+    sim.ops = 1000000;
+    sim.size = 0;
+    sim.theta = 0.99;
+    sim.hot_pct = 20;
+    sim.hotio_pct = 80;
+    sim.seed = 1;
+    sim.entropy_pct = 100;
+    sim.dup_pct = 100;
+    sim.noisy_pct = -1;
+    sim.nand = NULL;
+    ssd_config_init(&sim.cfg);
+    sim.cfg.verbose = 0;
+
+    for (int i = 0; i < argc; i++)
+    {
+        char* value = strchr(argv[i], '=');
+        if (!value)
+        {
+            return -1;
+        }
+        *value++ = '\0';
+
+        if (!strcmp(argv[i], "pattern"))
+        {
+            size_t p;
+            for (p = 0; p < sizeof(pattern_names) / sizeof(pattern_names[0]); p++)
+            {
+                if (!strcmp(value, pattern_names[p]))
+                {
+                    break;
+                }
+            }
+            if (p == sizeof(pattern_names) / sizeof(pattern_names[0]))
+            {
+                return -1;
+            }
+            sim.pattern = p;
+        }
+        else if (!strcmp(argv[i], "devices"))
+            sim.devices = strtoul(value, NULL, 0);
+        else if (!strcmp(argv[i], "bs"))
+            sim.bs = strtoul(value, NULL, 0);
+        else if (!strcmp(argv[i], "read"))
+            sim.read_pct = strtoul(value, NULL, 0);
+        else if (!strcmp(argv[i], "ops"))
+            sim.ops = strtoul(value, NULL, 0);
+        else if (!strcmp(argv[i], "size"))
+            sim.size = strtoul(value, NULL, 0);
+        else if (!strcmp(argv[i], "theta"))
+            sim.theta = strtod(value, NULL);
+        else if (!strcmp(argv[i], "hot"))
+            sim.hot_pct = strtoul(value, NULL, 0);
+        else if (!strcmp(argv[i], "hotio"))
+            sim.hotio_pct = strtoul(value, NULL, 0);
+        else if (!strcmp(argv[i], "seed"))
+            sim.seed = strtoul(value, NULL, 0);
+        else if (!strcmp(argv[i], "nand"))
+            sim.nand = value;
+        else if (!strcmp(argv[i], "timing"))
+            sim.cfg.timing = strtoul(value, NULL, 0);
+        else if (!strcmp(argv[i], "ecc"))
+            sim.cfg.ecc = strtoul(value, NULL, 0);
+        else if (!strcmp(argv[i], "ecc_rber"))
+            sim.cfg.ecc_rber = strtod(value, NULL);
+        else if (!strcmp(argv[i], "gc_pace"))
+            sim.cfg.gc_pace = strtoul(value, NULL, 0);
+        else if (!strcmp(argv[i], "compress"))
+            sim.cfg.compress = strtoul(value, NULL, 0);
+        else if (!strcmp(argv[i], "entropy"))
+            sim.entropy_pct = strtoul(value, NULL, 0);
+        else if (!strcmp(argv[i], "dedup"))
+            sim.cfg.dedup = strtoul(value, NULL, 0);
+        else if (!strcmp(argv[i], "dup"))
+            sim.dup_pct = strtoul(value, NULL, 0);
+        else if (!strcmp(argv[i], "slc"))
+            sim.cfg.slc_blocks = strtoul(value, NULL, 0);
+        else if (!strcmp(argv[i], "slc_idle"))
+            sim.cfg.slc_idle_ms = strtoul(value, NULL, 0);
+        else if (!strcmp(argv[i], "burst"))
+            sim.burst = strtoul(value, NULL, 0);
+        else if (!strcmp(argv[i], "idle"))
+            sim.idle_ms = strtoul(value, NULL, 0);
+        else if (!strcmp(argv[i], "volumes"))
+            sim.cfg.volumes = strtoul(value, NULL, 0);
+        else if (!strcmp(argv[i], "noisy"))
+            sim.noisy_pct = strtoul(value, NULL, 0);
+        else if (!strcmp(argv[i], "snap"))
+            sim.snap = strtoul(value, NULL, 0);
+        else if (!strcmp(argv[i], "zns"))
+            sim.cfg.zns = strtoul(value, NULL, 0);
+        else if (!strcmp(argv[i], "verify"))
+            sim.verify = strtoul(value, NULL, 0);
+        else if (!strcmp(argv[i], "verbose"))
+            sim.cfg.verbose = strtoul(value, NULL, 0);
+        else
+            return -1;
+    }
+
+    // Every volume gets an equal slice of the LBAs, like the FTL divides them
+    if (sim.cfg.volumes == 0 || sim.cfg.volumes > SSD_VOLUME_MAX || (sim.cfg.volumes > 1 && sim.cfg.zns) ||
+        sim.noisy_pct > 100 || (sim.snap != 0 && sim.cfg.zns))
+    {
+        return -1;
+    }
+    if (sim.size == 0)
+    {
+        sim.size = LOGICAL_NAND_NUM * NAND_SIZE_KB * 1024 / 512 / sim.cfg.volumes * 512;
+    }
+
+    if (sim.devices == 0 || sim.bs == 0 || sim.read_pct > 100 ||
+        sim.hot_pct > 100 || sim.hotio_pct > 100 || sim.dup_pct > 100 || sim.size < sim.bs)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+// Open device idx, in memory or in its own directory under nand=DIR
+static int sim_open(struct sim_device* d, unsigned int idx)
+{
+    struct ssd_config cfg = sim.cfg;
+
+    d->idx = idx;
+    d->rng = (sim.seed + idx) * 2654435761ULL | 1;
+    cfg.nand_dir = NULL;
+    if (sim.nand)
+    {
+        snprintf(d->nand_dir, sizeof(d->nand_dir), "%s/dev%u", sim.nand, idx);
+        if (mkdir(d->nand_dir, 0755) != 0 && errno != EEXIST)
+        {
+            fprintf(stderr, "Failed to create %s\n", d->nand_dir);
+            return -1;
+        }
+        cfg.nand_dir = d->nand_dir;
+    }
+
+    d->buf = malloc(sim.bs);
+    d->rbuf = malloc(sim.bs);
+    if (!d->buf || !d->rbuf)
+    {
+        return -1;
+    }
+    for (size_t k = 0; k < sim.bs; k++)
+    {
+        d->buf[k] = k % 512 < 512 * sim.entropy_pct / 100 ? sim_rand(&d->rng) : 0;
+    }
+
+    d->dev = ssd_dev_open(&cfg);
+    if (!d->dev || ssd_dev_start(d->dev) != 0)
+    {
+        return -1;
+    }
+
+    // A device kept under nand=DIR starts with the data a previous run left
+    if (sim.verify)
+    {
+        d->shadow = malloc(sim.cfg.volumes * sim.size);
+        if (!d->shadow)
+        {
+            return -1;
+        }
+        for (unsigned int vol = 0; vol < sim.cfg.volumes; vol++)
+        {
+            sim_shadow_load(d, vol, 0, sim.size);
+        }
+    }
+    return 0;
+}
+
+// Upper bound of the log2 bucket a percentile falls into
+static uint64_t sim_percentile(const struct ssd_lat_hist* h, double pct)
+{
+    uint64_t target = (uint64_t)ceil(h->total * pct / 100.0);
+    uint64_t seen = 0;
+
+    for (int i = 0; i < SSD_STATS_HIST_BUCKETS; i++)
+    {
+        seen += h->count[i];
+        if (seen >= target && seen > 0)
+        {
+            uint64_t upper = (2ULL << i) - 1;
+            return upper < h->max_ns ? upper : h->max_ns;
+        }
+    }
+    return h->max_ns;
+}
+
+static void sim_print_device(const struct sim_device* d, int last)
+{
+    struct ssd_dev_counters c;
+    struct ssd_stats st;
+    const struct ssd_lat_hist* w;
+    size_t ops = d->ops[0] + d->ops[1];
+
+    ssd_dev_get_counters(d->dev, 0, &c);
+    ssd_dev_get_stats(d->dev, &st);
+    w = &st.lat[SSD_LAT_HOST_WRITE];
+    printf("    { \"device\": %u, \"ops\": %zu, \"errors\": %zu, \"secs\": %.3f, \"ops_s\": %.1f, "
+           "\"read_bytes\": %zu, \"write_bytes\": %zu, \"host_write\": %zu, \"nand_write\": %zu, "
+           "\"wa\": %.6f, \"gc\": %zu, \"write_lat_ns\": { \"mean\": %.0f, \"p50\": %llu, \"p99\": %llu, "
+           "\"p99.9\": %llu, \"max\": %llu }",
+           d->idx, ops, d->errors, d->secs, d->secs > 0 ? ops / d->secs : 0,
+           d->bytes[0], d->bytes[1], c.host_write_size, c.nand_write_size,
+           c.host_write_size ? (double)c.nand_write_size / c.host_write_size : 0,
+           c.gc_count, w->total ? (double)w->sum_ns / w->total : 0,
+           (unsigned long long)sim_percentile(w, 50), (unsigned long long)sim_percentile(w, 99),
+           (unsigned long long)sim_percentile(w, 99.9), (unsigned long long)w->max_ns);
+    if (sim.cfg.slc_blocks)
+    {
+        printf(", \"slc\": { \"host_pages\": %llu, \"bypass_pages\": %llu, \"folded_pages\": %llu }",
+               (unsigned long long)st.slc_host_pages, (unsigned long long)st.slc_bypass_pages,
+               (unsigned long long)st.slc_folded_pages);
+    }
+    if (sim.cfg.volumes > 1)
+    {
+        printf(", \"mixed_blocks\": %u, \"volumes\": [", st.mixed_blocks);
+        for (unsigned int v = 0; v < st.volumes; v++)
+        {
+            const struct ssd_volume_stats* vs = &st.vol[v];
+            printf("%s{ \"volume\": %u, \"ops\": %llu, \"wa\": %.6f, \"blocks\": %u, \"shared_pages\": %llu, "
+                   "\"write_lat_ns\": { \"mean\": %.0f, \"p99\": %llu } }",
+                   v ? ", " : "", v, (unsigned long long)(vs->host_read_ops + vs->host_write_ops),
+                   vs->host_write_bytes ? vs->nand_write_ops * 512.0 / vs->host_write_bytes : 0,
+                   vs->blocks, (unsigned long long)vs->shared_pages,
+                   vs->write_lat.total ? (double)vs->write_lat.sum_ns / vs->write_lat.total : 0,
+                   (unsigned long long)sim_percentile(&vs->write_lat, 99));
+        }
+        printf("]");
+    }
+    if (sim.verify)
+    {
+        printf(", \"mismatches\": %zu", d->mismatches);
+    }
+    if (sim.snap != 0)
+    {
+        printf(", \"snapshots\": { \"taken\": %zu, \"pages\": %u, \"create_ns\": { \"mean\": %.0f, \"max\": %llu } }",
+               d->snaps_taken, st.snapshot_pages, d->snaps_taken ? (double)d->snap_ns_sum / d->snaps_taken : 0,
+               (unsigned long long)d->snap_ns_max);
+    }
+    printf(" }%s\n", last ? "" : ",");
+}
+
+int main(int argc, char** argv)
+{
+    struct sim_device* devs;
+    size_t total_ops = 0;
+    uint64_t start;
+    double secs;
+    int ret = 0;
+
+    if (sim_parse(argc - 1, argv + 1))
+    {
+        fprintf(stderr, "%s", usage);
+        return EINVAL;
+    }
+
+    sim_blocks = sim.size / sim.bs;
+    if (sim.pattern == PATTERN_ZIPF && zipf_init())
+    {
+        return ENOMEM;
+    }
+
+    devs = calloc(sim.devices, sizeof(*devs));
+    if (!devs)
+    {
+        return ENOMEM;
+    }
+    for (unsigned int i = 0; i < sim.devices; i++)
+    {
+        if (sim_open(&devs[i], i))
+        {
+            fprintf(stderr, "Failed to open device %u\n", i);
+            return EIO;
+        }
+    }
+
+    start = now_ns();
+    for (unsigned int i = 0; i < sim.devices; i++)
+    {
+        pthread_create(&devs[i].tid, NULL, sim_run, &devs[i]);
+    }
+    for (unsigned int i = 0; i < sim.devices; i++)
+    {
+        pthread_join(devs[i].tid, NULL);
+        total_ops += devs[i].ops[0] + devs[i].ops[1];
+        if (devs[i].errors || devs[i].mismatches)
+        {
+            ret = EIO;
+        }
+    }
+    secs = (now_ns() - start) / 1e9;
+
+    printf("{\n");
+    printf("  \"pattern\": \"%s\",\n", pattern_names[sim.pattern]);
+    printf("  \"bs\": %zu,\n", sim.bs);
+    printf("  \"read_pct\": %u,\n", sim.read_pct);
+    printf("  \"backend\": \"%s\",\n", sim.nand ? "file" : "memory");
+    printf("  \"devices\": [\n");
+    for (unsigned int i = 0; i < sim.devices; i++)
+    {
+        sim_print_device(&devs[i], i + 1 == sim.devices);
+    }
+    printf("  ],\n");
+    printf("  \"total_ops\": %zu,\n", total_ops);
+    printf("  \"secs\": %.3f,\n", secs);
+    printf("  \"ops_s\": %.1f\n", secs > 0 ? total_ops / secs : 0);
+    printf("}\n");
+
+    for (unsigned int i = 0; i < sim.devices; i++)
+    {
+        ssd_dev_close(devs[i].dev);
+        free(devs[i].buf);
+        free(devs[i].rbuf);
+        free(devs[i].shadow);
+    }
+    free(devs);
+    free(zipf_cdf);
+    return ret;
+}